@@ -0,0 +1,62 @@
+// Per-unit calibration of the ADC inputs
+//
+// The terminal dividers and the gain and offset of the ADC differ from unit to unit, and so do the voltages behind the
+// contact thresholds. Each input gets a gain and an offset that map its raw counts onto the counts of an ideal ADC and
+// divider. The DMA interrupt applies them to every sample as one multiply-add in Q16, so the conversions downstream
+// (adc_diff_mv(), ntc_centi_celsius()) keep their nominal constants. The coefficients are stored in flash next to the
+// checkpoint, see checkpoint.h; without a stored record the inputs are nominal. The simulation models an ideal ADC and
+// is never calibrated.
+//
+// With ADC_CALIBRATION they are measured by Serial command against a reference voltage, two points per input:
+//
+//   cal a0 500       500 mV between terminal A and ground, H-bridge off and no cell
+//   cal a0 1500      second point, gain and offset of A0 follow from the two
+//   cal a3 1650      reference at A3 in place of the NTC
+//   cal save         store in flash
+//   cal clear        back to nominal, until saved
+//   cal              show the coefficients
+//
+// A point averages ADC_CAL_SAMPLES samples of the input.
+
+#ifndef ADC_CAL_H
+#define ADC_CAL_H
+
+#include <Arduino.h>
+
+//#define ADC_CALIBRATION // calibrate the ADC inputs against a reference voltage by Serial command
+
+#if defined(ADC_CALIBRATION) && (defined(SIMULATION) || defined(TRACE_RECORD) || defined(TRACE_REPLAY) || defined(FAULT_INJECTION))
+#error "ADC_CALIBRATION needs the real ADC and the Serial port to itself"
+#endif
+
+#define ADC_CAL_SAMPLES 4096
+#define ADC_CAL_UNITY (1L << 16)
+
+// Calibrated inputs, in round-robin order
+enum ADC_CAL_INPUT {ADC_CAL_A0, ADC_CAL_A1, ADC_CAL_A3, ADC_CAL_INPUTS};
+
+struct AdcCalibration {
+  int32_t gainQ16[ADC_CAL_INPUTS];     // ADC_CAL_UNITY: nominal
+  int32_t offsetQ16[ADC_CAL_INPUTS];   // in LSB
+};
+
+constexpr AdcCalibration adcCalNominal = {{ADC_CAL_UNITY, ADC_CAL_UNITY, ADC_CAL_UNITY}, {0, 0, 0}};
+
+// Raw counts to nominal counts, rounded
+inline int adc_cal_apply(const AdcCalibration& calibration, int input, int counts){
+  return (counts * calibration.gainQ16[input] + calibration.offsetQ16[input] + ADC_CAL_UNITY / 2) >> 16;
+}
+
+// Core 1 before the ADC starts: the stored coefficients, or nominal
+void adc_cal_begin();
+// Current coefficients without waiting, false while core 0 changes them
+bool adc_cal_try_get(AdcCalibration& calibration);
+// Core 1: store the current coefficients in flash, the result is reported by adc_cal_poll()
+void adc_cal_save();
+
+#ifdef ADC_CALIBRATION
+// Core 0: Serial commands and measurements, true when "cal save" asks core 1 for adc_cal_save()
+bool adc_cal_poll();
+#endif
+
+#endif // ADC_CAL_H
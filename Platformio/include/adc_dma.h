@@ -0,0 +1,32 @@
+// Free-running ADC acquisition of the charge path
+//
+// The ADC converts A0, A1, A3 and the internal temperature sensor in round-robin at ADC_FRAME_RATE_HZ frames per
+// second; the fourth input only pads a frame to four samples. Two DMA channels, chained to each other, drain the ADC
+// FIFO alternately into two buffers of one block each, so the conversions never stop. When a channel completes, the
+// DMA interrupt on core 1 points it back at its buffer and feeds the terminal difference and the NTC sample of every
+// frame to the channel's oversampler, then publishes the latest windows through a sequence lock. Reading the latest
+// block is a copy of a few words; no CPU time is spent waiting on conversions. The samples of the terminals and the
+// NTC are calibrated on the way in, see adc_cal.h.
+//
+// Each channel writes in a ring over its own buffer. When the interrupt is held off longer than a block, e.g. while
+// flash is erased, the missed blocks are overwritten in place instead of running past the buffers.
+
+#ifndef ADC_DMA_H
+#define ADC_DMA_H
+
+#include "hal.h"
+#include "adc_cal.h"
+
+// Uncalibrated sums of the inputs over the latest block, for the calibration
+struct AdcRawBlock {
+  uint32_t sequence;
+  uint32_t sum[ADC_CAL_INPUTS];
+};
+
+// Claim the DMA channels and start the conversions. The DMA interrupt runs on the calling core.
+void adc_dma_begin();
+void adc_dma_block(AdcBlock& latest);
+void adc_dma_ratio(int channel, uint8_t log2Ratio);
+void adc_dma_raw(AdcRawBlock& raw);
+
+#endif // ADC_DMA_H
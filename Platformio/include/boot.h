@@ -0,0 +1,21 @@
+// Boot phases of both cores
+//
+// setup() on core 0 only brings up what is needed to show the clock and builds the settings tab after the first frame. Core 1
+// initializes the charge path in setup1() and brings up servo and sensor in the WAKEUP state, one stage per pass. Each core
+// times its own phases and marks the end of its boot, the watchdog and the boot report wait for both.
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <Arduino.h>
+
+// Close the running boot phase of the calling core
+void boot_phase(const char* name);
+// The calling core has booted
+void boot_done();
+bool boot_complete(int core);
+
+// Print the phases of both cores over Serial
+void boot_phases_report();
+
+#endif // BOOT_H
@@ -0,0 +1,110 @@
+// Charge path on core 1: sensing, the actuators and the charge state machine
+//
+// Core 1 runs charging, sensing and the actuators, core 0 runs LVGL and the buttons. The cores only talk through the
+// queues below: the FSM posts what happened on the event bus and never touches LVGL, the UI task drains the bus once per
+// frame and sends the button commands back. Everything in here reaches the hardware through hal.h only, so the same
+// code runs on the unit, against the models of charger_sim.h and against a trace.
+
+#ifndef CHARGE_H
+#define CHARGE_H
+
+#include <Arduino.h>
+#include "hal.h"
+#include "seqlock.h"
+#include "spsc_queue.h"
+#include "fault_inject.h"
+
+// H-bridge declarations
+enum HBR_STATE {OFF, A_POS, B_POS};
+extern int hbrdge_currentState;
+void h_bridge_set(int hbrState);
+
+const int LowerServoLimit = 1176; // Servo position for output chute
+const int ServoContactPos = 1400; // Servo position for charging
+const int UpperServoLimit = 1677; // Servo position for input chute
+extern int currentServoPos;
+
+enum FSM_STATE {WAKEUP, IDLE, FEED, CONTACT, SCREEN, CHARGE, ENDCHARGE, FSM_STATE_COUNT};
+extern int fsm_currentState;
+
+// Charge events -------------------------------------------------------------------------------------------------------------------------
+
+enum CHARGE_EVENT {EVT_CELL_DETECTED, EVT_LOADING, EVT_CHECKING, EVT_CHARGE_PROGRESS, EVT_EJECTING, EVT_FAULT, EVT_IDLE};
+enum FAULT_REASON {FAULT_NO_CONTACT, FAULT_VOLTAGE, FAULT_TEMPERATURE, FAULT_TIMEOUT,
+                   FAULT_REFUSED, FAULT_SHORTED, FAULT_DEAD, FAULT_HIGH_RESISTANCE, FAULT_CHARGER_STATUS,
+                   FAULT_TEMPERATURE_RISE, FAULT_REASON_COUNT};
+struct ChargeEvent {
+  uint8_t type;
+  uint8_t fault;          // EVT_FAULT: FAULT_REASON
+  int16_t batteryMv;      // EVT_CHARGE_PROGRESS
+};
+enum CHARGE_CMD {CMD_EJECT, CMD_CHECKPOINT, CMD_SAVE_CALIBRATION};
+
+extern SpscQueue<ChargeEvent, 16> eventBus;  // core 1 -> core 0
+extern SpscQueue<uint8_t, 4> commandQueue;   // core 0 -> core 1
+
+// Sensor snapshot ------------------------------------------------------------------------------------------------------------------------
+// The sensor task on core 1 is the only place that samples the cell and the charger. It publishes everything as one snapshot
+// through a sequence lock, so the FSM, the UI core or an ISR get a consistent copy without ever blocking the sensor task.
+
+struct SensorSnapshot {
+  int16_t batteryMv;      // V(A1) - V(A0), the sign gives the cell polarity; median of the last 5 passes
+  int16_t batteryMinMv;   // range of the unfiltered V(A1) - V(A0) over the last 100 ms
+  int16_t batteryMaxMv;
+  int16_t temperature;    // cell temperature in 0.01 °C, median of the last 5 passes
+  int16_t temperatureSlope; // 0.01 °C per minute over the last minute
+  uint16_t proximity;     // feeder chute proximity reading
+  AdcWindow adc[ADC_CHANNELS]; // the windows behind batteryMv and temperature, for the noise telemetry
+  bool chargerDone;       // CHG_STAT high: charge complete or disabled
+  bool chargerTimer;      // CHG_TMR level, toggles while the DS2712 timer oscillator runs
+  uint32_t timestamp;     // hal_millis() of the measurement
+};
+
+extern Seqlock<SensorSnapshot> sensorSnapshot;
+
+// Statistics -----------------------------------------------------------------------------------------------------------------------------
+
+// Throughput statistics, written by core 1
+struct ChargeStats {
+  uint32_t cells;           // cells fed and ejected
+  uint32_t cycleMsTotal;    // sum of feed-to-idle times
+  uint32_t resets;
+  uint32_t resetTimeouts;   // resets that fell back to the timeout
+  uint32_t resetMsTotal;
+  uint32_t resetMsMax;
+  uint32_t contacts;        // cells that reached CHARGE
+  uint32_t contactMsTotal;  // contact position reached until charging
+  uint32_t contactRetries;  // re-seat attempts
+  uint32_t retriedCells;    // cells that needed at least one re-seat
+  uint32_t retriedCharged;  // of those, cells that reached CHARGE
+  uint32_t stateMs[FSM_STATE_COUNT]; // time spent in each state
+};
+extern ChargeStats chargeStats;
+
+void charge_stats_report();
+#ifdef ADC_STATS
+void adc_stats_report();
+#endif
+
+// Required reactions to hardware faults, see fault_inject.h
+extern const FaultScenario faultScenarios[];
+extern const int FAULT_SCENARIO_COUNT;
+
+// Tasks ----------------------------------------------------------------------------------------------------------------------------------
+
+// Core 1 before its scheduler starts: pins, ADC, checkpoint and trace; servo and sensor follow in the WAKEUP state
+void charge_begin();
+
+void task_charge();
+void task_sensors();
+void task_proximity();
+#ifdef SIMULATION
+// One SIM_STEP_MS step of the models and the charge path
+void charge_sim_step();
+void task_sim();
+#endif
+#ifdef TRACE_REPLAY
+void task_replay();
+#endif
+
+#endif // CHARGE_H
@@ -0,0 +1,54 @@
+// Plant models behind the hardware access layer when SIMULATION is defined, see hal.h
+//
+// A stack of cells waits in the input chute. The models follow the feeder arm through the servo
+// pulse width: raising it to the chute loads the next cell, lowering it into the contact window
+// connects the cell to the terminals and lowering it to the output chute ejects it. A connected
+// cell is charged by the DS2712 model while the H-bridge polarity matches the cell orientation,
+// which moves its voltage, temperature, CHG_STAT and CHG_TMR. The models only depend on the
+// simulated clock, which advances through sim_advance(), so the charge path runs as fast as the
+// core can execute it. On the unit the scheduler gives it SIM_PASS_BUDGET_US of every period;
+// the native tests step it without a budget, see native/charge_path.h.
+
+#ifndef CHARGER_SIM_H
+#define CHARGER_SIM_H
+
+#include <Arduino.h>
+
+#define SIM_STEP_MS 1             // simulated time per charge path pass
+#define SIM_PASS_BUDGET_US 4000   // real time spent simulating per 5 ms scheduler period
+#define SIM_STACK_CELLS 12        // cells put into the input chute whenever it runs empty
+#define SIM_CLOCK_START 783258120 // wall clock at the start, 2024-10-26 11:42 like the build-time default of the RTC
+
+// CELL_NIMH_HOT heats up while it is charged, like a cell with a soft internal short. It is only fed by sim_cell_type().
+enum SIM_CELL_TYPE {CELL_NIMH, CELL_NIMH_MARGINAL, CELL_ALKALINE, CELL_DEAD, CELL_SHORTED, CELL_NIMH_HOT, CELL_TYPE_COUNT};
+
+// Cells by type since sim_begin()
+struct SimStats {
+  uint32_t fed[CELL_TYPE_COUNT];
+  uint32_t charged[CELL_TYPE_COUNT];    // ended by the -dV termination of the DS2712
+  uint32_t ejected[CELL_TYPE_COUNT];
+  uint32_t shootThroughMs;              // both MOSFETs of an H-bridge leg on
+};
+
+void sim_begin(uint32_t seed);
+void sim_advance(uint32_t ms);
+// Cells slid into the input chute from now on are all of this SIM_CELL_TYPE, CELL_TYPE_COUNT restores the random mix.
+// The cell already waiting in the chute keeps its type.
+void sim_cell_type(int type);
+uint32_t sim_millis();
+uint32_t sim_clock();                // wall clock in seconds, see hal_clock()
+
+int sim_analog_read(uint8_t pin);
+void sim_adc_block(AdcBlock& block); // from sim_analog_read(), a new block every ADC_BLOCK_MS
+void sim_adc_ratio(int channel, uint8_t log2Ratio);
+int sim_digital_read(uint8_t pin);
+void sim_digital_write(uint8_t pin, int value);
+void sim_servo_attach(bool attached);
+void sim_servo_write(int us);
+int sim_proximity();
+
+void sim_stats(SimStats& stats);
+// Print simulated time, speed-up and the cells by type over Serial
+void sim_report();
+
+#endif // CHARGER_SIM_H
@@ -0,0 +1,54 @@
+// Power-fail-safe checkpoint of the charge state machine in flash
+//
+// Records are appended to two flash sectors reserved as the (unused) filesystem area, see
+// board_build.filesystem_size in platformio.ini. Each 32-byte slot is written once; when a
+// sector is full the other one is erased and filled next, so the newest valid record always
+// survives a power failure during an erase or program. Loading scans both sectors in the XIP
+// window and takes the valid record with the highest sequence number.
+//
+// checkpoint_save() must only be called from one core. It pauses the other core for the
+// duration of the flash operation: about 1 ms per record, a sector erase once every 128
+// records. The erase typically takes 45 ms, up to CHECKPOINT_STALL_MAX_MS on the QSPI parts
+// of these boards. The hardware watchdog is reloaded to cover that, the next
+// watchdog_update() restores its timeout, and checkpoint_flash_stalled() tells the task
+// watchdog not to count the stall as a hang.
+//
+// The ADC calibration (adc_cal.h) has one record in the sector after the two, rewritten in place:
+// it only changes on the bench, and a write cut short leaves no valid record and nominal inputs.
+// Save it from the core that saves checkpoints.
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <Arduino.h>
+#include <hardware/rtc.h>
+#include "adc_cal.h"
+
+#define CHECKPOINT_STALL_MAX_MS 400 // datasheet maximum of a 4 kB sector erase
+
+struct Checkpoint {
+  uint8_t state;          // FSM_STATE
+  uint8_t reserved;
+  int16_t servoPos;       // servo pulse width in microseconds
+  uint32_t chargeStart;   // wall clock when the charge started, 0: not charging
+  uint32_t wallClock;     // wall clock when the record was written
+};
+
+// Latest valid record, false if there is none. Read-only, safe on either core.
+bool checkpoint_load(Checkpoint& checkpoint);
+
+// Append a record, false if flash could not be written
+bool checkpoint_save(const Checkpoint& checkpoint);
+
+// True while a flash operation pauses the other core and until graceMs after it ended. Safe on either core.
+bool checkpoint_flash_stalled(uint32_t graceMs);
+
+// Stored ADC calibration, false if there is none
+bool checkpoint_load_calibration(AdcCalibration& calibration);
+bool checkpoint_save_calibration(const AdcCalibration& calibration);
+
+// Wall clock in seconds since 2000-01-01 00:00
+uint32_t checkpoint_clock(const datetime_t& dt);
+void checkpoint_datetime(uint32_t clock, datetime_t& dt);
+
+#endif // CHECKPOINT_H
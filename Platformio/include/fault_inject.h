@@ -0,0 +1,85 @@
+// Fault injection at the hardware access layer
+//
+// With FAULT_INJECTION the HAL passes every reading of the charge path through this layer, which can replace it with a
+// sensor or actuator fault. A scenario names the fault, the FSM state it is injected in, the reaction it must cause and
+// the time allowed for it. Scenarios are run by Serial command:
+//
+//   fault ntc_open     inject on the next entry of the scenario's state
+//   fault clear        cancel
+//   fault              list the scenarios
+//
+// Once active, the reaction time is measured in hal_millis() (simulated time with SIMULATION) and reported as
+//
+//   [fault] ntc_open: H-bridge off after 55 ms, limit 200 ms - ok
+//
+// It counts from the first reading or write the fault changes. A stuck signal that agrees with the hardware does nothing
+// yet: CHG_STAT stuck at "charging" only takes effect once the DS2712 ends the charge, which is reported first as
+//
+//   [fault] chg_stat_low: in effect 5171234 ms after the injection
+//
+// or "- FAILED", after which the fault is removed again. A host script can run the scenarios one after another and
+// only needs to look for FAILED; test/test_faults does so against the simulation. The scenario table lives with the
+// state machine in charge.cpp.
+
+#ifndef FAULT_INJECT_H
+#define FAULT_INJECT_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+#if defined(FAULT_INJECTION) && defined(TRACE_REPLAY)
+#error "a replay does not read the hardware, there is nothing to inject into"
+#endif
+
+// Hardware faults. The NTC sits on the low side of its divider: an open sensor reads full scale, a shorted one reads 0,
+// the two ends ntc_centi_celsius() clamps.
+enum INJECT_FAULT {
+  INJECT_NONE,
+  INJECT_NTC_OPEN,        // ADC_TEMP_BAT reads 4095
+  INJECT_NTC_SHORT,       // ADC_TEMP_BAT reads 0
+  INJECT_CHG_STAT_HIGH,   // CHG_STAT stuck at "done"
+  INJECT_CHG_STAT_LOW,    // CHG_STAT stuck at "charging"
+  INJECT_PROXIMITY_I2C,   // the VCNL4040 does not answer, reads return 0
+  INJECT_SERVO_STUCK,     // servo pulses change, the arm does not move
+};
+
+// What the charge path has to do about it, within limitMs of the injection
+enum FAULT_REACTION {
+  REACT_BRIDGE_OFF,       // switch the H-bridge off
+  REACT_LEAVE,            // leave the state the fault was injected in
+  REACT_STAY,             // stay in that state for at least limitMs, e.g. no false feed
+};
+
+struct FaultScenario {
+  const char* name;
+  int fault;              // INJECT_FAULT
+  int state;              // FSM_STATE to inject in
+  int reaction;           // FAULT_REACTION
+  uint32_t limitMs;
+};
+
+#ifdef FAULT_INJECTION
+// Core 1, from the HAL: the reading or write as the fault leaves it
+void fault_adc_block(AdcBlock& block);
+int fault_digital(uint8_t pin, int value);
+bool fault_proximity_begin(bool ok);
+int fault_proximity(int value);
+bool fault_servo_stuck();
+void fault_observe_write(uint8_t pin, int value);
+
+// Core 1, from the state machine on every state change
+void fault_observe_state(int state);
+
+// Core 0: Serial commands and the verdicts
+void fault_poll(const FaultScenario* scenarios, int count);
+#else
+inline void fault_adc_block(AdcBlock&){}
+inline int fault_digital(uint8_t, int value){ return value; }
+inline bool fault_proximity_begin(bool ok){ return ok; }
+inline int fault_proximity(int value){ return value; }
+inline bool fault_servo_stuck(){ return false; }
+inline void fault_observe_write(uint8_t, int){}
+inline void fault_observe_state(int){}
+#endif
+
+#endif // FAULT_INJECT_H
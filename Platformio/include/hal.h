@@ -0,0 +1,62 @@
+// Hardware access of the charge path
+//
+// The charge state machine, the sensor task and the watchdog reach the cell terminals, the
+// charger, the H-bridge, the servo and the proximity sensor only through these functions, and
+// take their time from hal_millis() and the wall clock from hal_clock(). Normally they forward
+// to the Arduino core, the RTC and the drivers. With SIMULATION the plant models in
+// charger_sim.cpp answer instead and both clocks are simulated, so the unmodified state machine
+// runs without cells or a charger attached.
+// FAULT_INJECTION can replace readings with sensor faults (fault_inject.h), TRACE_RECORD and
+// TRACE_REPLAY record every access or replay a recording in its place (trace.h).
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <Arduino.h>
+#include "oversample.h"
+
+//#define SIMULATION // run the charge path against the models in charger_sim.cpp, the H-bridge pins stay low
+//#define TRACE_RECORD // print every access of the charge path over Serial
+//#define TRACE_REPLAY // run the charge path against a trace received over Serial, the pins are not driven
+//#define FAULT_INJECTION // inject sensor and actuator faults by Serial command and time the reaction, see fault_inject.h
+
+uint32_t hal_millis();
+// Wall clock in seconds since 2000-01-01 00:00, see checkpoint_clock(); only valid once core 0 has set the RTC
+bool hal_clock_running();
+uint32_t hal_clock();
+
+// The ADC runs free in round-robin over the cell terminals and the NTC at ADC_FRAME_RATE_HZ frames (one sample per
+// input), see adc_dma.h. Each channel is oversampled over its own window, see oversample.h; the latest windows are
+// published as a block every ADC_BLOCK_MS.
+#define ADC_FRAME_RATE_HZ 16000
+#define ADC_BLOCK_FRAMES 64
+#define ADC_BLOCK_MS (ADC_BLOCK_FRAMES * 1000 / ADC_FRAME_RATE_HZ)
+
+enum ADC_CHANNEL {
+  ADC_CHANNEL_BATTERY,    // V(A1) - V(A0) of a frame
+  ADC_CHANNEL_TEMP,       // ADC_TEMP_BAT
+  ADC_CHANNELS
+};
+
+struct AdcBlock {
+  uint32_t sequence;                // blocks since the ADC started, 0: none yet
+  AdcWindow window[ADC_CHANNELS];   // latest complete window per channel
+};
+
+void hal_adc_begin();
+// Latest complete block, does not wait for a conversion
+void hal_adc_block(AdcBlock& block);
+// Oversampling ratio of a channel from its next window on
+void hal_adc_ratio(int channel, uint8_t log2Ratio);
+int hal_digital_read(uint8_t pin);
+void hal_digital_write(uint8_t pin, int value);
+
+// Start the servo pulses at the given width, so attaching does not move the arm
+void hal_servo_attach(int us);
+void hal_servo_detach();
+void hal_servo_write(int us);
+
+bool hal_proximity_begin();
+int hal_proximity();
+
+#endif // HAL_H
@@ -0,0 +1,57 @@
+// Instrumented allocator behind LVGL's lv_mem_alloc()/lv_mem_free() (LV_MEM_CUSTOM)
+//
+// Tracks current and peak usage, allocation/free/failure counts and a size histogram.
+// With LVGL_HEAP_TLSF the memory comes from a static two-level segregated fit pool, so every
+// allocation and free takes bounded time and fragmentation can be measured; otherwise the
+// requests are forwarded to malloc/free with a small size header.
+//
+// This header is included from LVGL's C sources through lv_conf.h, so it must stay valid C.
+
+#ifndef LVGL_HEAP_H
+#define LVGL_HEAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef LVGL_HEAP_TLSF
+#define LVGL_HEAP_TLSF 1 // 1: O(1) static pool, 0: forward to malloc
+#endif
+
+#ifndef LVGL_HEAP_SIZE
+#define LVGL_HEAP_SIZE (32U * 1024U) // pool size in bytes, size it from the reported peak
+#endif
+
+#define LVGL_HEAP_SIZE_BINS 8 // histogram bins: <=16, <=32, ... <=1024, larger
+
+typedef struct {
+  uint32_t used;           // payload bytes currently allocated
+  uint32_t peak;           // highest value of used since boot
+  uint32_t blocks;         // live allocations
+  uint32_t allocs;         // successful allocations (realloc counts as one)
+  uint32_t frees;
+  uint32_t failed;         // allocations that could not be served
+  uint32_t free_total;     // free bytes in the pool (TLSF only)
+  uint32_t free_biggest;   // largest free block (TLSF only)
+  uint8_t frag_pct;        // 100 - biggest / total free (TLSF only)
+  uint32_t size_bins[LVGL_HEAP_SIZE_BINS];
+} lvgl_heap_stats_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void* lvgl_heap_alloc(size_t size);
+void lvgl_heap_free(void* ptr);
+void* lvgl_heap_realloc(void* ptr, size_t size);
+
+// Fill stats, walking the pool for the fragmentation figures (O(number of blocks))
+void lvgl_heap_get_stats(lvgl_heap_stats_t* stats);
+
+// Print the statistics and the LVGL object count per widget type over Serial
+void lvgl_heap_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LVGL_HEAP_H
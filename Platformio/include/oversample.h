@@ -0,0 +1,90 @@
+// Oversampling and decimation of one ADC channel
+//
+// A window of 2^log2Ratio consecutive samples is summed into one output. With at least about one LSB of noise on the
+// input, every factor of four in the ratio adds a bit of resolution: the decimated value is the sum shifted right by
+// (log2Ratio + 1) / 2. A larger ratio costs no CPU time, the ADC converts continuously anyway, only latency: a window
+// takes 2^log2Ratio / ADC_FRAME_RATE_HZ seconds. Every output carries the variance, minimum and maximum of its samples,
+// accumulated along the way, so the noise of each channel is known at all times and the ratio can be picked to meet a
+// target precision with oversample_ratio_for().
+
+#ifndef OVERSAMPLE_H
+#define OVERSAMPLE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+#define OVERSAMPLE_DEFAULT_LOG2_RATIO 6   // 64 samples
+#define OVERSAMPLE_MAX_LOG2_RATIO 12      // 4096 samples, six more bits, 256 ms at 16 kHz
+
+// One decimated output and the statistics of the samples it was taken from
+struct AdcWindow {
+  uint32_t sequence;      // windows completed on the channel, 0: none yet
+  int32_t sum;            // of the 2^log2Ratio samples, in LSB
+  uint32_t varianceQ8;    // of the samples, in LSB² with 8 fraction bits
+  int16_t min;
+  int16_t max;
+  uint8_t log2Ratio;
+};
+
+// Resolution of the decimated output for an input of inputBits
+constexpr int adc_window_bits(const AdcWindow& window, int inputBits = 12){
+  return inputBits + window.log2Ratio / 2;
+}
+
+constexpr int32_t adc_window_value(const AdcWindow& window){
+  return window.sum >> ((window.log2Ratio + 1) / 2);
+}
+
+// Smallest ratio at which the mean of samples with the given variance has a standard deviation of at most targetQ8 LSB
+// (8 fraction bits): the variance of a mean of N samples is the sample variance / N. Without noise there is nothing to
+// average and the result is 0; oversampling then gains no resolution either.
+inline uint8_t oversample_ratio_for(uint32_t varianceQ8, uint32_t targetQ8){
+  uint64_t limit = (uint64_t)targetQ8 * targetQ8;
+  uint8_t log2Ratio = 0;
+  while(log2Ratio < OVERSAMPLE_MAX_LOG2_RATIO && ((uint64_t)varianceQ8 << 8 >> log2Ratio) > limit) log2Ratio++;
+  return log2Ratio;
+}
+
+// Single producer: add() runs in one context only, set_ratio() may be called from anywhere
+class Oversampler {
+ public:
+  // Takes effect with the next window, the one in progress keeps its ratio
+  void set_ratio(uint8_t log2Ratio){
+    nextLog2Ratio.store(min(log2Ratio, (uint8_t)OVERSAMPLE_MAX_LOG2_RATIO), std::memory_order_relaxed);
+  }
+
+  // True when the sample completed a window, which is then in window
+  bool add(int16_t sample, AdcWindow& window){
+    if(count == 0){
+      log2Ratio = nextLog2Ratio.load(std::memory_order_relaxed);
+      sum = 0;
+      sumSquares = 0;
+      sampleMin = INT16_MAX;
+      sampleMax = INT16_MIN;
+    }
+    sum += sample;
+    sumSquares += (uint32_t)(sample * sample);
+    if(sample < sampleMin) sampleMin = sample;
+    if(sample > sampleMax) sampleMax = sample;
+    if(++count < 1UL << log2Ratio) return false;
+
+    // (sum of squares - sum² / N) / N, the divisions are shifts
+    uint64_t squaredSum = (uint64_t)((int64_t)sum * sum);
+    uint64_t varianceQ8 = ((sumSquares << 8) - ((squaredSum << 8) >> log2Ratio)) >> log2Ratio;
+    window = {++sequence, sum, (uint32_t)min(varianceQ8, (uint64_t)UINT32_MAX), sampleMin, sampleMax, log2Ratio};
+    count = 0;
+    return true;
+  }
+
+ private:
+  std::atomic<uint8_t> nextLog2Ratio{OVERSAMPLE_DEFAULT_LOG2_RATIO};
+  uint8_t log2Ratio = OVERSAMPLE_DEFAULT_LOG2_RATIO;
+  uint32_t count = 0;
+  int32_t sum = 0;
+  uint64_t sumSquares = 0;
+  int16_t sampleMin = INT16_MAX;
+  int16_t sampleMax = INT16_MIN;
+  uint32_t sequence = 0;
+};
+
+#endif // OVERSAMPLE_H
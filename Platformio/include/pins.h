@@ -0,0 +1,32 @@
+// Pin assignment of the SPINC board, shared by the firmware and the simulation models
+
+#ifndef PINS_H
+#define PINS_H
+
+#define SW_A 2 // SW_2
+#define SW_B 0 // SW_1
+#define USER_LED 14 // 25 for Pico
+
+#define LCD_CS 1
+#define LCD_MOSI 3
+#define LCD_SCK 6
+
+#define SDA 4
+#define SCL 5
+#define VCN_INT 7
+
+#define CHG_STAT 8
+#define CHG_TMR 11
+
+#define PWM_SERVO 15
+
+#define HBR_AH 9
+#define HBR_AL 10
+#define HBR_BL 12
+#define HBR_BH 13
+
+#define ADC_BAT_A A0
+#define ADC_BAT_B A1
+#define ADC_TEMP_BAT A3
+
+#endif // PINS_H
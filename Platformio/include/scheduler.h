@@ -0,0 +1,50 @@
+// Cooperative multi-rate scheduler
+//
+// Tasks are kept in a static table in priority order. scheduler_run() starts every task whose
+// release time has come, measures how long it ran and sleeps until the next release. A task
+// overruns when it finishes later than its deadline after its release, e.g. because a task
+// before it took too long.
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+struct Task {
+  const char* name;
+  void (*run)();
+  uint32_t periodUs;
+  uint32_t deadlineUs;  // relative to the release time
+  // runtime statistics
+  volatile uint32_t nextRelease; // read by the watchdog on the other core
+  uint32_t runs;
+  uint32_t lastRunUs;
+  uint32_t maxRunUs;
+  uint32_t longestRunUs; // maxRunUs since boot, not reset by the report
+  uint32_t maxLatencyUs; // release to completion
+  uint32_t overruns;    // completed after the deadline
+  uint32_t skipped;     // releases dropped because the task was more than a period late
+  volatile bool busy;   // run() is executing
+  volatile uint32_t startUs; // micros() when run() was last called
+};
+
+#define TASK(name, run, periodMs, deadlineMs) {name, run, (periodMs) * 1000UL, (deadlineMs) * 1000UL, 0, 0, 0, 0, 0, 0, 0, 0, false, 0}
+
+// Release all tasks now
+void scheduler_start(Task* tasks, int count);
+
+// Run all due tasks once, then sleep until the next release
+void scheduler_run(Task* tasks, int count);
+
+// Index of a task that is more than lateUs past its release, preferring the one still running,
+// or -1 while the table makes progress. Meant to be called from the other core.
+int scheduler_stuck(const Task* tasks, int count, uint32_t lateUs);
+
+// Longest pass over the table since boot, the sum of the longest run of every task. A released task waits at most one
+// pass before it runs.
+uint32_t scheduler_longest_pass(const Task* tasks, int count);
+
+// Print the statistics of every task over Serial and reset the maxima
+void scheduler_report(Task* tasks, int count);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,38 @@
+// Integer sensor conversions of the charge path
+//
+// Cell voltages are int16_t millivolts, temperatures int16_t hundredths of a degree Celsius. Each conversion takes the
+// integer sum of an ADC block and scales it once, the M0+ has no FPU and every float operation would be a library
+// call. The thresholds of the state machine are integers in the same units.
+
+#ifndef SENSING_H
+#define SENSING_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+//#define SENSE_BENCH // print cycles per conversion of the integer and the former float code, and per filter update, over Serial
+
+#define ADC_UV_PER_LSB 1612       // differential, 2 * 0.806 mV: both terminals are divided by two
+
+// NTC to ground, series resistor to the 3.3 V ADC reference
+#define NTC_NOMINAL_OHM 10000     // at 25 °C
+#define NTC_B 3380
+#define NTC_SERIES_OHM 10000
+#define NTC_T0_CENTI_K 29815      // 25 °C
+#define CENTI_K_AT_0C 27315
+
+// V(A1) - V(A0) in mV from the sum of the differences over 2^log2Ratio frames, rounded
+constexpr int16_t adc_diff_mv(int32_t sum, uint8_t log2Ratio){
+  int32_t uv = ((int64_t)sum * ADC_UV_PER_LSB) >> log2Ratio;
+  return (uv + (uv >= 0 ? 500 : -500)) / 1000;
+}
+
+// NTC temperature in 0.01 °C from the sum of 2^log2Ratio samples, interpolated in a table the compiler generates from
+// the constants above. An open sensor reads far below 0 °C and a shorted one far above 60 °C.
+int16_t ntc_centi_celsius(uint32_t sum, uint8_t log2Ratio);
+
+#ifdef SENSE_BENCH
+void sensing_bench();
+#endif
+
+#endif // SENSING_H
@@ -0,0 +1,63 @@
+// Sequence lock for publishing a small struct from one writer to any number of readers
+//
+// The writer makes the sequence odd, copies the value and makes it even again; it never waits.
+// A reader copies the value between two reads of the sequence and retries if the writer was
+// active in between, so it always gets a consistent (torn-free) copy. The value is stored as
+// relaxed atomic words, which keeps the concurrent copy free of data races.
+//
+// read() spins while a write is in progress. An interrupt handler on the writer's core must use
+// tryRead() instead, it would otherwise wait for a writer that cannot run.
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+template <typename T>
+class Seqlock {
+  static_assert(std::is_trivially_copyable<T>::value, "seqlock values are copied word by word");
+
+public:
+  // Writer side, one writer only
+  void write(const T& value){
+    uint32_t buf[WORDS] = {};
+    memcpy(buf, &value, sizeof(T));
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for(size_t i = 0; i < WORDS; i++) words[i].store(buf[i], std::memory_order_relaxed);
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  // Single attempt, returns false if a write was in progress
+  bool tryRead(T& value) const {
+    uint32_t buf[WORDS];
+    uint32_t s0 = seq.load(std::memory_order_acquire);
+    if(s0 & 1) return false;
+    for(size_t i = 0; i < WORDS; i++) buf[i] = words[i].load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if(seq.load(std::memory_order_relaxed) != s0) return false;
+    memcpy(&value, buf, sizeof(T));
+    return true;
+  }
+
+  T read() const {
+    T value;
+    while(!tryRead(value)) {}
+    return value;
+  }
+
+  // Number of completed writes
+  uint32_t version() const { return seq.load(std::memory_order_acquire) / 2; }
+
+private:
+  static constexpr size_t WORDS = (sizeof(T) + 3) / 4;
+  std::atomic<uint32_t> seq{0};
+  std::atomic<uint32_t> words[WORDS] = {};
+};
+
+#endif // SEQLOCK_H
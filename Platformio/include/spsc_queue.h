@@ -0,0 +1,60 @@
+// Lock-free single-producer/single-consumer ring buffer
+//
+// One side (e.g. core 1) only calls push(), the other side (e.g. core 0) only calls pop().
+// Each index is written by exactly one side, so no lock or read-modify-write is needed; the
+// release/acquire pair makes the item visible before the index that publishes it.
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+template <typename T, size_t N>
+class SpscQueue {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "queue size must be a power of two");
+
+public:
+  // Producer side. Never blocks, returns false and counts a drop when the queue is full.
+  bool push(const T& item){
+    uint32_t h = head.load(std::memory_order_relaxed);
+    if(h - tail.load(std::memory_order_acquire) == N){
+      dropped++;
+      return false;
+    }
+    items[h & (N - 1)] = item;
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false when the queue is empty.
+  bool pop(T& item){
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if(head.load(std::memory_order_acquire) == t) return false;
+    item = items[t & (N - 1)];
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Copies the oldest item without removing it.
+  bool peek(T& item) const {
+    uint32_t t = tail.load(std::memory_order_relaxed);
+    if(head.load(std::memory_order_acquire) == t) return false;
+    item = items[t & (N - 1)];
+    return true;
+  }
+
+  // Items queued, the other side may have changed it by the time the caller looks
+  uint32_t size() const { return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire); }
+
+  uint32_t drops() const { return dropped; }
+
+private:
+  T items[N];
+  std::atomic<uint32_t> head{0}; // written by the producer
+  std::atomic<uint32_t> tail{0}; // written by the consumer
+  uint32_t dropped = 0;          // producer side only
+};
+
+#endif // SPSC_QUEUE_H
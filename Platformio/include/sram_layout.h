@@ -0,0 +1,39 @@
+// SRAM placement of the large buffers and the render hot path
+//
+// The RP2040 main SRAM (banks 0-3) is word-striped by the stock linker script, so every large
+// array ends up spread over all four banks no matter where it is declared, and the script
+// gathers every .bss* section into that region: a named .bss section does not move a buffer.
+// SCRATCH_X and SCRATCH_Y are independent 4 kB banks that the stock memmap already uses for the
+// core 1 and core 0 stacks. What we can decide without a linker script of our own is the
+// alignment of the buffers and which code runs from RAM instead of competing with the flash
+// XIP cache. Compare the two options with SRAM_BENCH in main.cpp.
+//
+// This header is included from lv_conf.h, so it must stay valid C.
+
+#ifndef SRAM_LAYOUT_H
+#define SRAM_LAYOUT_H
+
+#define SRAM_LAYOUT_LINKER  0 // no attributes, the linker decides (original behaviour)
+#define SRAM_LAYOUT_RAMCODE 1 // word-aligned buffers and RAM-resident render code
+
+#ifndef SRAM_LAYOUT
+#define SRAM_LAYOUT SRAM_LAYOUT_RAMCODE
+#endif
+
+#if SRAM_LAYOUT == SRAM_LAYOUT_RAMCODE
+  // LVGL draw buffers A/B - written by the CPU while rendering
+  #define SRAM_DRAW_BUF  __attribute__((aligned(4)))
+  // LCD framebuffer - read by the SPI transfer in refresh()
+  #define SRAM_FRAME_BUF __attribute__((aligned(4)))
+  // LVGL object heap (lv_mem pool)
+  #define SRAM_LV_POOL   __attribute__((aligned(4)))
+  // Code executed from RAM, copied there by the startup code together with .data
+  #define SRAM_FAST_CODE __attribute__((section(".time_critical.sram")))
+#else
+  #define SRAM_DRAW_BUF
+  #define SRAM_FRAME_BUF
+  #define SRAM_LV_POOL
+  #define SRAM_FAST_CODE
+#endif
+
+#endif // SRAM_LAYOUT_H
@@ -0,0 +1,161 @@
+// Streaming filters for the sensor channels
+//
+// Fixed size, no allocation, templated on the integer sample type and the window length. An update does not depend on
+// how long the filter has run: the median shifts at most N entries of its sorted copy, the min/max tracker drops each
+// sample at most once (amortized constant), the EMA and the regression slope keep running sums. Until the window has
+// filled, each filter works on the samples it has.
+
+#ifndef STREAM_FILTER_H
+#define STREAM_FILTER_H
+
+#include <stdint.h>
+#include <type_traits>
+
+// Accumulator wide enough for sums over a window of narrow samples
+template <typename T>
+using FilterAcc = typename std::conditional<sizeof(T) <= 2, int32_t, int64_t>::type;
+
+// Moving median of the last N samples, a single outlier never shows in the output
+template <typename T, int N>
+class MedianFilter {
+  static_assert(std::is_integral<T>::value, "integer samples");
+  static_assert(N % 2 == 1, "odd window, the median is one of the samples");
+
+ public:
+  T update(T sample){
+    int i = count;
+    if(count == N){
+      // take the oldest out of the sorted copy, the gap becomes the insert position
+      T oldest = ring[head];
+      i = 0;
+      while(sorted[i] != oldest) i++;
+      while(i < N - 1 && sorted[i + 1] < sample){ sorted[i] = sorted[i + 1]; i++; }
+    }
+    else count++;
+    while(i > 0 && sorted[i - 1] > sample){ sorted[i] = sorted[i - 1]; i--; }
+    sorted[i] = sample;
+    ring[head] = sample;
+    head = head == N - 1 ? 0 : head + 1;
+    return value();
+  }
+
+  T value() const { return sorted[(count - 1) / 2]; }
+
+ private:
+  T ring[N] = {};
+  T sorted[N] = {};
+  int head = 0;
+  int count = 0;
+};
+
+// Exponential moving average with a weight of 2^-LOG2_N, about the mean of the last 2^LOG2_N samples. Kept with LOG2_N
+// fraction bits, so small steps are not rounded away.
+template <typename T, int LOG2_N>
+class Ema {
+  static_assert(std::is_integral<T>::value, "integer samples");
+  static_assert(LOG2_N > 0 && LOG2_N < 16, "weight between 1/2 and 2^-15");
+
+ public:
+  T update(T sample){
+    if(!primed) state = (FilterAcc<T>)sample << LOG2_N;
+    else state += sample - ((state + HALF) >> LOG2_N);
+    primed = true;
+    return value();
+  }
+
+  T value() const { return (state + HALF) >> LOG2_N; }
+
+ private:
+  static constexpr FilterAcc<T> HALF = (FilterAcc<T>)1 << (LOG2_N - 1);
+  FilterAcc<T> state = 0;
+  bool primed = false;
+};
+
+// Least-squares slope over the last N samples, for trends like dT/dt. The oldest sample is x = 0; sliding the window
+// shifts every x down by one, which takes the sum of the samples off the weighted sum.
+template <typename T, int N>
+class SlopeFilter {
+  static_assert(std::is_integral<T>::value, "integer samples");
+  static_assert(N >= 2, "a slope needs two samples");
+
+ public:
+  void update(T sample){
+    if(count == N){
+      T oldest = ring[head];
+      sumXY += (int64_t)(N - 1) * sample - (sumY - oldest);
+      sumY += sample - oldest;
+    }
+    else{
+      sumXY += (int64_t)count * sample;
+      sumY += sample;
+      count++;
+    }
+    ring[head] = sample;
+    head = head == N - 1 ? 0 : head + 1;
+  }
+
+  // Change in sample units per `per` updates, rounded toward zero; 0 until two samples are in
+  int32_t slope(int32_t per = 1) const {
+    if(count < 2) return 0;
+    int64_t n = count;
+    int64_t numerator = n * sumXY - n * (n - 1) / 2 * sumY;
+    int64_t denominator = n * n * (n * n - 1) / 12;
+    return numerator * per / denominator;
+  }
+
+ private:
+  T ring[N] = {};
+  int head = 0;
+  int count = 0;
+  int64_t sumY = 0;
+  int64_t sumXY = 0;
+};
+
+// Smallest and largest of the last N samples, each kept in a queue of the candidates that can still become extreme
+template <typename T, int N>
+class MinMaxFilter {
+  static_assert(std::is_integral<T>::value, "integer samples");
+
+ public:
+  void update(T sample){
+    push(lows, sample, true);
+    push(highs, sample, false);
+    index++;
+  }
+
+  T lowest() const { return lows.entries[lows.head].value; }
+  T highest() const { return highs.entries[highs.head].value; }
+
+ private:
+  struct Entry {
+    T value;
+    uint32_t index;
+  };
+  struct Queue {
+    Entry entries[N] = {};
+    int head = 0;
+    int count = 0;
+  };
+
+  // An older candidate that is not more extreme than the new sample can never be reported again
+  void push(Queue& queue, T sample, bool lowest){
+    if(queue.count && queue.entries[queue.head].index + N <= index){
+      queue.head = queue.head == N - 1 ? 0 : queue.head + 1;
+      queue.count--;
+    }
+    while(queue.count){
+      int back = (queue.head + queue.count - 1) % N;
+      T value = queue.entries[back].value;
+      if(lowest ? value < sample : value > sample) break;
+      queue.count--;
+    }
+    queue.entries[(queue.head + queue.count) % N] = {sample, index};
+    queue.count++;
+  }
+
+  Queue lows;
+  Queue highs;
+  uint32_t index = 0;
+};
+
+#endif // STREAM_FILTER_H
@@ -0,0 +1,102 @@
+// Record and replay of the charge path at the hardware access layer
+//
+// With TRACE_RECORD every input the charge path takes on core 1 is logged in the order it is read: ADC blocks, CHG_STAT,
+// CHG_TMR and proximity readings, the time whenever it has changed, commands from the buttons, the checkpoint decision
+// at boot and the clock. The actuator writes, the FSM state changes and the start of every task pass are logged in
+// between. Core 0 prints the log over Serial as lines of tokens:
+//
+//   [trace] k0 T5 A0:81 A1:20 A2:-3 A3:94 A4:-2 A5:1 A6:6 A7:20 A8:121088 A9:0 A10:1892 ...
+//
+// A token is the channel letter, the pin or source followed by ':' where the channel has one, and the value. Inputs are
+// upper case, outputs lower case. A USB serial port takes the full rate; flash is too small and too slow to write from
+// core 1 (a trace grows by about 15 kB/s at the task periods of the unit, measured with native/record_trace.cpp), so
+// there is no flash target. The charge path waits for the host to open the port, a trace always starts at boot.
+//
+// With TRACE_REPLAY the same firmware runs against a recorded trace instead of the hardware: send the [trace] lines of a
+// recording and a final "[trace] end" line back over Serial. Core 1 runs the recorded task passes in their order and in
+// recorded time. Every read returns the recorded value and every actuator write and state change is compared with the
+// recording instead of driving the pins, so an unchanged charge path reproduces the recording exactly. The first
+// difference stops the replay and is printed with its record number; a host script only needs to look for "[trace]
+// replay diverged". The last pass is incomplete in every recording and is not replayed. A trace with lost records
+// cannot be replayed. test/test_replay replays every trace kept in its traces/ directory on the host.
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <Arduino.h>
+#include "hal.h"
+
+#if defined(TRACE_RECORD) && defined(TRACE_REPLAY)
+#error "TRACE_RECORD and TRACE_REPLAY exclude each other"
+#endif
+#if defined(TRACE_REPLAY) && defined(SIMULATION)
+#error "a replay takes the place of the models, undefine SIMULATION"
+#endif
+
+#define TRACE_QUEUE_SIZE 1024       // records buffered between the cores, about 0.5 s at the full rate
+#define TRACE_LINE_RECORDS 16       // tokens per [trace] line
+#define TRACE_PASS_BUDGET_US 4000   // real time spent replaying per 5 ms scheduler period
+
+// Channels, the letter is the token prefix
+enum TRACE_CHANNEL : char {
+  TRACE_TIME = 'T',       // hal_millis() advanced by the value
+  TRACE_ANALOG = 'A',     // ADC block, source 0: sequence, then per channel the AdcWindow fields in declaration order
+  TRACE_DIGITAL = 'D',    // source: pin
+  TRACE_PROXIMITY = 'P',
+  TRACE_SENSOR = 'B',     // proximity sensor initialized
+  TRACE_COMMAND = 'C',    // command from core 0
+  TRACE_RESUME = 'R',     // boot decision, source 0: state, 1: seconds charged before the reset, 2: servo position
+  TRACE_CLOCK = 'W',      // source 0: clock set, 1: wall clock
+  TRACE_TASK = 'k',       // start of a task pass, value: task number
+  TRACE_WRITE = 'w',      // source: pin
+  TRACE_SERVO = 's',      // pulse width
+  TRACE_ATTACH = 'h',     // pulse width, 0: detached
+  TRACE_STATE = 'f',      // FSM state entered
+  TRACE_RATIO = 'o',      // source: ADC channel, value: log2 of the oversampling ratio
+};
+
+struct TraceRecord {
+  char channel;
+  uint8_t source;
+  int32_t value;
+};
+
+#if defined(TRACE_RECORD) || defined(TRACE_REPLAY)
+// Start recording or replaying, called on core 1 once its hardware is set up. Records before are neither taken nor
+// compared. Recording waits for the host to open the serial port, replaying for the first task pass of the trace.
+void trace_begin();
+
+// Serial side on core 0: print the recorded records, or read the trace and report the result of the replay
+void trace_poll();
+// Record the block, or replace it with the recorded one when replaying
+void trace_adc_block(AdcBlock& block);
+#else
+inline void trace_begin(){}
+inline void trace_adc_block(AdcBlock&){}
+#endif
+
+#if defined(TRACE_RECORD)
+int32_t trace_record(char channel, uint8_t source, int32_t value);
+uint32_t trace_record_time(uint32_t now);
+#define TRACE_INPUT(channel, source, read) trace_record(channel, source, read)
+#define TRACE_OUTPUT(channel, source, value) trace_record(channel, source, value)
+#define TRACE_TIME_INPUT(read) trace_record_time(read)
+
+#elif defined(TRACE_REPLAY)
+int32_t trace_replay_input(char channel, uint8_t source);
+void trace_replay_output(char channel, uint8_t source, int32_t value);
+uint32_t trace_replay_time();
+bool trace_replay_optional(char channel, int32_t& value); // take the next record only if it is on this channel
+int trace_replay_next_task();                             // task number of the next complete pass, -1: none yet
+// The read is not evaluated, a replay never touches the hardware
+#define TRACE_INPUT(channel, source, read) trace_replay_input(channel, source)
+#define TRACE_OUTPUT(channel, source, value) trace_replay_output(channel, source, value)
+#define TRACE_TIME_INPUT(read) trace_replay_time()
+
+#else
+#define TRACE_INPUT(channel, source, read) (read)
+#define TRACE_OUTPUT(channel, source, value) ((void)0)
+#define TRACE_TIME_INPUT(read) (read)
+#endif
+
+#endif // TRACE_H
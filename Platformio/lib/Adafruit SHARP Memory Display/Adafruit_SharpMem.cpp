@@ -84,9 +84,11 @@ Adafruit_SharpMem::Adafruit_SharpMem(uint8_t clk, uint8_t mosi, uint8_t cs,
  * @brief Start the driver object, setting up pins and configuring a buffer for
  * the screen contents
  *
+ * @param buffer Optional statically placed framebuffer of (width * height) / 8
+ * bytes. If NULL the buffer is allocated on the heap.
  * @return boolean true: success false: failure
  */
-boolean Adafruit_SharpMem::begin(void) {
+boolean Adafruit_SharpMem::begin(uint8_t *buffer) {
   
   // Initialize hardware SPI for the earlephilhower core
   SPI.setSCK(_clk);
@@ -100,7 +102,10 @@ boolean Adafruit_SharpMem::begin(void) {
   // Set the vcom bit to a defined state
   _sharpmem_vcom = SHARPMEM_BIT_VCOM;
 
-  sharpmem_buffer = (uint8_t *)malloc((WIDTH * HEIGHT) / 8);
+  if (buffer)
+    sharpmem_buffer = buffer;
+  else
+    sharpmem_buffer = (uint8_t *)malloc((WIDTH * HEIGHT) / 8);
 
   if (!sharpmem_buffer)
     return false;
@@ -0,0 +1,14 @@
+// VCNL4040 driver on the host, for the native tests: no sensor answers
+
+#ifndef NATIVE_ADAFRUIT_VCNL4040_H
+#define NATIVE_ADAFRUIT_VCNL4040_H
+
+#include <Arduino.h>
+
+class Adafruit_VCNL4040 {
+ public:
+  bool begin(){ return false; }
+  uint16_t getProximity(){ return 0; }
+};
+
+#endif // NATIVE_ADAFRUIT_VCNL4040_H
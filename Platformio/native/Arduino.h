@@ -0,0 +1,127 @@
+// Arduino core on the host, for the native tests
+//
+// Only what the charge path uses. Time is the real time since the program started, the pins read as inputs with
+// nothing connected, and Serial collects what the firmware prints and hands it the lines a test queues for it.
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <thread>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define A0 26
+#define A1 27
+#define A2 28
+#define A3 29
+
+using std::abs;
+
+template <typename T, typename L, typename H>
+T constrain(T x, L low, H high){
+  return x < low ? low : x > high ? high : x;
+}
+
+template <typename T, typename U>
+auto max(const T& a, const U& b) -> decltype(b < a ? a : b){
+  return b < a ? a : b;
+}
+
+template <typename T, typename U>
+auto min(const T& a, const U& b) -> decltype(b < a ? b : a){
+  return b < a ? b : a;
+}
+
+inline uint64_t native_micros(){
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline unsigned long millis(){ return native_micros() / 1000; }
+inline unsigned long micros(){ return (uint32_t)native_micros(); }
+inline void delay(unsigned long ms){ std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+inline void pinMode(uint8_t, uint8_t){}
+inline void digitalWrite(uint8_t, uint8_t){}
+inline int digitalRead(uint8_t){ return LOW; }
+inline int analogRead(uint8_t){ return 0; }
+inline void noInterrupts(){}
+inline void interrupts(){}
+
+class HostSerial {
+ public:
+  std::string input;        // queued for the firmware to read
+  std::string output;       // everything printed
+  bool echo = true;         // also to stdout
+
+  operator bool() const { return true; }
+  void begin(unsigned long){}
+  int available(){ return input.size() - inputRead; }
+  int read(){ return inputRead < input.size() ? (uint8_t)input[inputRead++] : -1; }
+
+  // The firmware formats its 32-bit values with %lu and %ld, as on the 32-bit target
+  size_t printf(const char* format, ...){
+    std::string ilp32 = format;
+    for(size_t i = ilp32.find('%'); i != std::string::npos; i = ilp32.find('%', i)){
+      i++;
+      if(ilp32[i] == '%'){ i++; continue; }
+      while(i < ilp32.size() && strchr("-+ #0123456789.*", ilp32[i])) i++;
+      if(i < ilp32.size() && ilp32[i] == 'l' && ilp32[i + 1] != 'l') ilp32.erase(i, 1);
+    }
+    char text[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text, sizeof(text), ilp32.c_str(), args);
+    va_end(args);
+    write(text);
+    return n;
+  }
+  size_t print(const char* text){ return write(text); }
+  size_t println(const char* text = ""){ return write(text) + write("\n"); }
+
+ private:
+  size_t inputRead = 0;
+
+  size_t write(const char* text){
+    output += text;
+    if(echo) fputs(text, stdout);
+    return strlen(text);
+  }
+};
+
+inline HostSerial Serial;
+
+class TwoWire {
+ public:
+  void begin(){}
+};
+
+inline TwoWire Wire;
+
+// The host runs the charge path, core 1 on the unit
+class RP2040 {
+ public:
+  int cpuid(){ return 1; }
+  uint32_t hwrand32(){ return rand(); }
+  uint32_t getCycleCount(){ return native_micros() * 133; }
+  void idleOtherCore(){}
+  void resumeOtherCore(){}
+};
+
+inline RP2040 rp2040;
+
+#endif // NATIVE_ARDUINO_H
@@ -0,0 +1,13 @@
+// Servo library on the host, for the native tests
+
+#ifndef NATIVE_SERVO_H
+#define NATIVE_SERVO_H
+
+class Servo {
+ public:
+  int attach(int){ return 0; }
+  void detach(){}
+  void writeMicroseconds(int){}
+};
+
+#endif // NATIVE_SERVO_H
@@ -0,0 +1,26 @@
+// The charge path on the host, for the native tests
+//
+// A test defines the mode it runs in, SIMULATION or TRACE_REPLAY and optionally FAULT_INJECTION, and then includes this
+// file. The sources of the charge path are compiled into the test in that mode against the Arduino shim in native/, so
+// one [env:native] hosts every mode without building src/. The host stands in for core 1: rp2040.cpuid() is 1 and the
+// test calls the tasks and the Serial side (trace_poll(), fault_poll()) itself. The simulated clock only advances through
+// charge_sim_step(), the test runs it as fast as the host goes.
+//
+// The globals of the charge path are only initialized once per process; a test that needs a fresh boot per case forks.
+
+#ifndef NATIVE_CHARGE_PATH_H
+#define NATIVE_CHARGE_PATH_H
+
+#if !defined(SIMULATION) && !defined(TRACE_REPLAY)
+#error "the host has no hardware, define SIMULATION or TRACE_REPLAY before including charge_path.h"
+#endif
+
+#include "../src/boot.cpp"
+#include "../src/sensing.cpp"
+#include "../src/hal.cpp"
+#include "../src/trace.cpp"
+#include "../src/fault_inject.cpp"
+#include "../src/charger_sim.cpp"
+#include "../src/charge.cpp"
+
+#endif // NATIVE_CHARGE_PATH_H
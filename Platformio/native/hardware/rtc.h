@@ -0,0 +1,21 @@
+// RTC of the pico SDK on the host, for the native tests: never set
+
+#ifndef NATIVE_HARDWARE_RTC_H
+#define NATIVE_HARDWARE_RTC_H
+
+#include <stdint.h>
+
+typedef struct {
+  int16_t year;
+  int8_t month;
+  int8_t day;
+  int8_t dotw;
+  int8_t hour;
+  int8_t min;
+  int8_t sec;
+} datetime_t;
+
+inline bool rtc_running(){ return false; }
+inline bool rtc_get_datetime(datetime_t*){ return false; }
+
+#endif // NATIVE_HARDWARE_RTC_H
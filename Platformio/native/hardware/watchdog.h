@@ -0,0 +1,8 @@
+// Watchdog of the pico SDK on the host, for the native tests: every start is a power-on
+
+#ifndef NATIVE_HARDWARE_WATCHDOG_H
+#define NATIVE_HARDWARE_WATCHDOG_H
+
+inline bool watchdog_caused_reboot(){ return false; }
+
+#endif // NATIVE_HARDWARE_WATCHDOG_H
@@ -0,0 +1,36 @@
+// Record the simulated charge path on the host, for the traces of test/test_replay
+//
+//   g++ -std=gnu++17 -O2 -I include -I native native/record_trace.cpp -o record_trace
+//   ./record_trace 9 8600 > test/test_replay/traces/sim_alkaline.trace
+//
+// Boots the charge path against the models with the given seed and records it for the given simulated milliseconds.
+// The tasks run at the periods of the unit, see the task table in main.cpp, so the trace has the size and the rate of
+// one recorded on it; both are printed to stderr.
+
+#define SIMULATION
+#define TRACE_RECORD
+#include "charge_path.h"
+
+int main(int argc, char** argv){
+  if(argc != 3){
+    fprintf(stderr, "usage: record_trace <seed> <ms>\n");
+    return 1;
+  }
+  uint32_t seed = strtoul(argv[1], NULL, 10);
+  uint32_t ms = strtoul(argv[2], NULL, 10);
+
+  boot_phase("startup");
+  sim_begin(seed);
+  charge_begin();
+  while(sim_millis() < ms){
+    sim_advance(1);
+    uint32_t now = sim_millis();
+    if(now % 5 == 0) task_charge();
+    if(now % 10 == 0) task_sensors();
+    if(now % 100 == 0) task_proximity();
+    trace_poll();
+  }
+  fprintf(stderr, "%zu bytes in %lu ms, %lu bytes/s\n", Serial.output.size(), (unsigned long)ms,
+          (unsigned long)(Serial.output.size() * 1000 / ms));
+  return 0;
+}
@@ -0,0 +1,161 @@
+// Per-unit calibration of the ADC inputs, see adc_cal.h
+
+#include <atomic>
+#include "seqlock.h"
+#include "checkpoint.h"
+#include "adc_cal.h"
+
+// Written by core 1 at boot and by core 0 on the bench, read by the DMA interrupt on core 1
+static Seqlock<AdcCalibration> current;
+
+enum CAL_SAVE {SAVE_NONE, SAVE_OK, SAVE_FAILED};
+static std::atomic<int> saveResult{SAVE_NONE}; // set by core 1, reported and cleared by core 0
+
+void adc_cal_begin(){
+  AdcCalibration calibration;
+  if(!checkpoint_load_calibration(calibration)) calibration = adcCalNominal;
+  current.write(calibration);
+}
+
+bool adc_cal_try_get(AdcCalibration& calibration){
+  return current.tryRead(calibration);
+}
+
+void adc_cal_save(){
+  bool saved = checkpoint_save_calibration(current.read());
+  saveResult.store(saved ? SAVE_OK : SAVE_FAILED, std::memory_order_release);
+}
+
+#ifdef ADC_CALIBRATION
+
+#include "sensing.h"
+#include "adc_dma.h"
+
+#define CAL_LINE_SIZE 40
+#define CAL_UV_PER_LSB_PIN 806    // 3.3 V / 4096, at A3
+#define CAL_MIN_SPAN 500          // LSB between the two points of an input
+#define CAL_MAX_GAIN_ERROR 6554   // 10 % of ADC_CAL_UNITY
+#define CAL_MAX_OFFSET 100        // LSB
+
+static const char* const inputNames[ADC_CAL_INPUTS] = {"a0", "a1", "a3"};
+
+// Raw mean and the nominal counts of the reference, both in LSB with 8 fraction bits
+struct CalPoint {
+  int32_t measuredQ8;
+  int32_t expectedQ8;
+};
+static CalPoint points[ADC_CAL_INPUTS][2];
+static int pointCount[ADC_CAL_INPUTS];
+
+// Measurement in progress, input -1: none
+static int measureInput = -1;
+static int32_t measureExpectedQ8;
+static uint64_t measureSum;
+static uint32_t measureSamples;
+static uint32_t measureSequence;
+
+static char line[CAL_LINE_SIZE];
+static int lineLength = 0;
+
+static void print_input(int input, const AdcCalibration& calibration){
+  Serial.printf("[cal] %s: gain %.4f offset %.2f LSB\n", inputNames[input],
+                calibration.gainQ16[input] / (float)ADC_CAL_UNITY, calibration.offsetQ16[input] / (float)ADC_CAL_UNITY);
+}
+
+// Gain and offset through the two points of the input
+static void cal_fit(int input){
+  const CalPoint& a = points[input][0];
+  const CalPoint& b = points[input][1];
+  if(abs(b.measuredQ8 - a.measuredQ8) < CAL_MIN_SPAN * 256){
+    Serial.printf("[cal] %s: points less than %d LSB apart, take another one\n", inputNames[input], CAL_MIN_SPAN);
+    return;
+  }
+  int64_t gainQ16 = ((int64_t)(b.expectedQ8 - a.expectedQ8) << 16) / (b.measuredQ8 - a.measuredQ8);
+  int64_t offsetQ16 = ((int64_t)a.expectedQ8 << 8) - ((gainQ16 * a.measuredQ8) >> 8);
+  if(llabs(gainQ16 - ADC_CAL_UNITY) > CAL_MAX_GAIN_ERROR || llabs(offsetQ16) > (int64_t)CAL_MAX_OFFSET << 16){
+    Serial.printf("[cal] %s: gain %.4f offset %.2f LSB out of range, check the reference\n", inputNames[input],
+                  gainQ16 / (float)ADC_CAL_UNITY, offsetQ16 / (float)ADC_CAL_UNITY);
+    return;
+  }
+  AdcCalibration calibration = current.read();
+  calibration.gainQ16[input] = gainQ16;
+  calibration.offsetQ16[input] = offsetQ16;
+  current.write(calibration);
+  print_input(input, calibration);
+}
+
+static void cal_point_done(){
+  int input = measureInput;
+  measureInput = -1;
+  CalPoint point = {(int32_t)((measureSum << 8) / measureSamples), measureExpectedQ8};
+  if(pointCount[input] == 2) points[input][0] = points[input][1];
+  points[input][pointCount[input] == 2 ? 1 : pointCount[input]++] = point;
+  Serial.printf("[cal] %s: %.2f LSB measured, %.2f expected\n", inputNames[input], point.measuredQ8 / 256.0f,
+                point.expectedQ8 / 256.0f);
+  if(pointCount[input] == 2) cal_fit(input);
+}
+
+static bool cal_command(){
+  char name[8];
+  int mv;
+  if(strcmp(line, "cal") == 0){
+    AdcCalibration calibration = current.read();
+    for(int i = 0; i < ADC_CAL_INPUTS; i++) print_input(i, calibration);
+  }
+  else if(strcmp(line, "cal save") == 0){
+    return true;
+  }
+  else if(strcmp(line, "cal clear") == 0){
+    current.write(adcCalNominal);
+    memset(pointCount, 0, sizeof(pointCount));
+    Serial.println("[cal] nominal, not saved");
+  }
+  else if(sscanf(line, "cal %7s %d", name, &mv) == 2){
+    int input = -1;
+    for(int i = 0; i < ADC_CAL_INPUTS; i++) if(strcmp(name, inputNames[i]) == 0) input = i;
+    if(input < 0 || mv <= 0) Serial.println("[cal] usage: cal a0|a1|a3 <reference mV>");
+    else{
+      // the terminals are divided by two before the pin
+      int uvPerLsb = input == ADC_CAL_A3 ? CAL_UV_PER_LSB_PIN : ADC_UV_PER_LSB;
+      measureExpectedQ8 = (int64_t)mv * 1000 * 256 / uvPerLsb;
+      measureSum = 0;
+      measureSamples = 0;
+      measureSequence = 0;
+      measureInput = input;
+    }
+  }
+  else Serial.println("[cal] commands: cal, cal a0|a1|a3 <reference mV>, cal save, cal clear");
+  return false;
+}
+
+bool adc_cal_poll(){
+  bool save = false;
+  while(Serial.available()){
+    char c = Serial.read();
+    if(c == '\n' || c == '\r'){
+      line[lineLength] = 0;
+      if(lineLength) save |= cal_command();
+      lineLength = 0;
+    }
+    else if(lineLength < CAL_LINE_SIZE - 1) line[lineLength++] = c;
+  }
+
+  // blocks the poll misses are skipped, the reference does not change
+  if(measureInput >= 0){
+    AdcRawBlock raw;
+    adc_dma_raw(raw);
+    if(raw.sequence != measureSequence){
+      measureSequence = raw.sequence;
+      measureSum += raw.sum[measureInput];
+      measureSamples += ADC_BLOCK_FRAMES;
+      if(measureSamples >= ADC_CAL_SAMPLES) cal_point_done();
+    }
+  }
+
+  int result = saveResult.exchange(SAVE_NONE, std::memory_order_acquire);
+  if(result == SAVE_OK) Serial.println("[cal] saved");
+  if(result == SAVE_FAILED) Serial.println("[cal] flash write failed");
+  return save;
+}
+
+#endif
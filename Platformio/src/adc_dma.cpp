@@ -0,0 +1,101 @@
+// Free-running ADC acquisition of the charge path, see adc_dma.h
+
+#include <hardware/adc.h>
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include "pins.h"
+#include "seqlock.h"
+#include "adc_dma.h"
+
+#define ADC_INPUTS 4                // samples per frame, in input order: A0, A1, A3, temperature sensor
+#define ADC_TEMP_SENSOR_INPUT 4
+#define ADC_CLOCK_HZ 48000000
+#define ADC_BLOCK_SAMPLES (ADC_BLOCK_FRAMES * ADC_INPUTS)
+#define ADC_BUFFER_BYTES (ADC_BLOCK_SAMPLES * 2)
+#define ADC_BUFFER_RING_BITS 9    // log2(ADC_BUFFER_BYTES)
+
+static_assert(ADC_BAT_A < ADC_BAT_B && ADC_BAT_B < ADC_TEMP_BAT, "round-robin order must match ADC_CAL_INPUT");
+static_assert(ADC_CLOCK_HZ / (ADC_FRAME_RATE_HZ * ADC_INPUTS) >= 96, "faster than the ADC converts");
+static_assert(ADC_FRAME_RATE_HZ * ADC_BLOCK_MS == ADC_BLOCK_FRAMES * 1000, "a block must be a whole number of ms");
+static_assert(1 << ADC_BUFFER_RING_BITS == ADC_BUFFER_BYTES, "the write ring must span one buffer");
+
+static uint16_t buffers[2][ADC_BLOCK_SAMPLES] __attribute__((aligned(ADC_BUFFER_BYTES)));
+static int dmaChannels[2];
+static Oversampler oversamplers[ADC_CHANNELS];
+static AdcBlock block;              // only touched by the DMA interrupt
+static AdcCalibration calibration = adcCalNominal;
+static Seqlock<AdcBlock> latestBlock;
+static Seqlock<AdcRawBlock> latestRaw;
+
+static void __not_in_flash_func(adc_dma_reduce)(const uint16_t* samples){
+  adc_cal_try_get(calibration); // keeps the last coefficients while core 0 changes them
+  AdcRawBlock raw = {block.sequence + 1, {0, 0, 0}};
+  for(int i = 0; i < ADC_BLOCK_SAMPLES; i += ADC_INPUTS){
+    int countsA = samples[i + ADC_CAL_A0];
+    int countsB = samples[i + ADC_CAL_A1];
+    int countsTemp = samples[i + ADC_CAL_A3];
+    raw.sum[ADC_CAL_A0] += countsA;
+    raw.sum[ADC_CAL_A1] += countsB;
+    raw.sum[ADC_CAL_A3] += countsTemp;
+    int diff = adc_cal_apply(calibration, ADC_CAL_A1, countsB) - adc_cal_apply(calibration, ADC_CAL_A0, countsA);
+    oversamplers[ADC_CHANNEL_BATTERY].add(diff, block.window[ADC_CHANNEL_BATTERY]);
+    int temp = constrain(adc_cal_apply(calibration, ADC_CAL_A3, countsTemp), 0, 4095); // the NTC table ends there
+    oversamplers[ADC_CHANNEL_TEMP].add(temp, block.window[ADC_CHANNEL_TEMP]);
+  }
+  block.sequence++;
+  latestBlock.write(block);
+  latestRaw.write(raw);
+}
+
+// The other channel is already running, re-arm the finished one for its next turn and reduce its buffer
+static void __not_in_flash_func(adc_dma_irq)(){
+  for(int i = 0; i < 2; i++){
+    if(!dma_channel_get_irq1_status(dmaChannels[i])) continue;
+    dma_channel_acknowledge_irq1(dmaChannels[i]);
+    dma_channel_set_write_addr(dmaChannels[i], buffers[i], false);
+    adc_dma_reduce(buffers[i]);
+  }
+}
+
+void adc_dma_begin(){
+  adc_cal_begin();
+  adc_init();
+  adc_gpio_init(ADC_BAT_A);
+  adc_gpio_init(ADC_BAT_B);
+  adc_gpio_init(ADC_TEMP_BAT);
+  adc_set_temp_sensor_enabled(true);
+  adc_select_input(ADC_BAT_A - A0);
+  adc_set_round_robin(1 << (ADC_BAT_A - A0) | 1 << (ADC_BAT_B - A0) | 1 << (ADC_TEMP_BAT - A0) | 1 << ADC_TEMP_SENSOR_INPUT);
+  adc_fifo_setup(true, true, 1, false, false); // DREQ on every sample, 12-bit results without the error flag
+  adc_set_clkdiv(ADC_CLOCK_HZ / (ADC_FRAME_RATE_HZ * ADC_INPUTS) - 1);
+
+  for(int i = 0; i < 2; i++) dmaChannels[i] = dma_claim_unused_channel(true);
+  for(int i = 0; i < 2; i++){
+    dma_channel_config config = dma_channel_get_default_config(dmaChannels[i]);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, ADC_BUFFER_RING_BITS);
+    channel_config_set_dreq(&config, DREQ_ADC);
+    channel_config_set_chain_to(&config, dmaChannels[1 - i]);
+    dma_channel_configure(dmaChannels[i], &config, buffers[i], &adc_hw->fifo, ADC_BLOCK_SAMPLES, false);
+    dma_channel_set_irq1_enabled(dmaChannels[i], true);
+  }
+  irq_add_shared_handler(DMA_IRQ_1, adc_dma_irq, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+
+  dma_channel_start(dmaChannels[0]);
+  adc_run(true);
+}
+
+void adc_dma_block(AdcBlock& latest){
+  latest = latestBlock.read();
+}
+
+void adc_dma_raw(AdcRawBlock& raw){
+  raw = latestRaw.read();
+}
+
+void adc_dma_ratio(int channel, uint8_t log2Ratio){
+  oversamplers[channel].set_ratio(log2Ratio);
+}
@@ -0,0 +1,39 @@
+// Boot phases of both cores, see boot.h
+
+#include <atomic>
+#include "boot.h"
+
+struct BootPhase {
+  const char* name;
+  uint32_t us;
+};
+// One phase table per core, each only written by its own core
+static BootPhase bootPhases[2][8];
+static int bootPhaseCount[2] = {0, 0};
+static uint32_t bootPhaseStart[2] = {0, 0}; // micros() counts from reset, so the first phase covers the core startup
+static std::atomic<bool> bootDone[2] = {{false}, {false}};
+
+void boot_phase(const char* name){
+  int core = rp2040.cpuid();
+  uint32_t now = micros();
+  if(bootPhaseCount[core] < (int)(sizeof(bootPhases[0]) / sizeof(bootPhases[0][0]))){
+    bootPhases[core][bootPhaseCount[core]++] = {name, now - bootPhaseStart[core]};
+  }
+  bootPhaseStart[core] = now;
+}
+
+void boot_done(){
+  bootDone[rp2040.cpuid()].store(true, std::memory_order_release);
+}
+
+bool boot_complete(int core){
+  return bootDone[core].load(std::memory_order_acquire);
+}
+
+void boot_phases_report(){
+  for(int core = 0; core < 2; core++){
+    for(int i = 0; i < bootPhaseCount[core]; i++){
+      Serial.printf("[boot] core%d %-12s %7lu us\n", core, bootPhases[core][i].name, bootPhases[core][i].us);
+    }
+  }
+}
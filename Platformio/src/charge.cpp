@@ -0,0 +1,853 @@
+// Charge path on core 1, see charge.h
+
+#include <hardware/watchdog.h>
+#include "checkpoint.h"
+#include "pins.h"
+#include "boot.h"
+#include "trace.h"
+#include "sensing.h"
+#include "adc_cal.h"
+#include "stream_filter.h"
+#include "charge.h"
+#ifdef SIMULATION
+#include "charger_sim.h"
+#endif
+
+int hbrdge_currentState = OFF;
+
+// Proximity Sensor declaration
+const int proxThreshold = 75; // detectipon threshold for detecting battery in input chute
+bool proximityReady = false; // set once the sensor is initialized
+int proximity = 0; // latest reading of the proximity task
+
+int currentServoPos = LowerServoLimit;
+
+// State machine, the transition table is in the "Charge state machine" section
+int fsm_currentState = WAKEUP;
+#define CHARGE_MAX_DWELL_MS (5UL * 3600000) // backstop behind the DS2712 charge timer
+#define CHARGE_MIN_CENTI_C 0                // cell temperature window while charging, 0.01 °C
+#define CHARGE_MAX_CENTI_C 6000
+#define CHARGE_MAX_SLOPE 200                // 0.01 °C per minute, about twice the dT/dt of a NiMH cell at the end of charge
+// Waits are timed sub-states checked against hal_millis(), no state blocks the loop
+enum FEED_STEP {FEED_RAISE, FEED_DROP};
+enum CONTACT_STEP {CONTACT_LOWER, CONTACT_SETTLE, CONTACT_CHECK, CONTACT_BACKOFF};
+enum ENDCHARGE_STEP {EJECT_LOWER, EJECT_RESET};
+int fsm_subState = 0;
+uint32_t fsm_stateStart = 0;   // hal_millis() when the current sub-state was entered
+uint32_t fsm_stateEntered = 0; // hal_millis() when the current state was entered
+
+void fsm_set_substate(int subState){
+  fsm_subState = subState;
+  fsm_stateStart = hal_millis();
+}
+
+void fsm_set_state(int state);
+
+uint32_t fsm_elapsed(){
+  return hal_millis() - fsm_stateStart;
+}
+
+// Charge events -------------------------------------------------------------------------------------------------------------------------
+
+SpscQueue<ChargeEvent, 16> eventBus;
+SpscQueue<uint8_t, 4> commandQueue;
+
+// Post an event without blocking, a full bus drops it (the next progress event repairs the display)
+void event_post(uint8_t type, int16_t batteryMv = 0){
+  eventBus.push({type, 0, batteryMv});
+}
+
+void event_post_fault(uint8_t reason){
+  eventBus.push({EVT_FAULT, reason, 0});
+}
+
+// Latest block of the free-running ADC, fetched once per sensor pass
+AdcBlock adcBlock;
+
+// The terminals keep the one-block window the contact check is timed for. The NTC is averaged just long enough for a
+// standard deviation of half an LSB (about 0.02 °C in the charge window) at the noise it shows; at least 16 samples so
+// the variance stays meaningful, at most 64 ms so a sensor fault is still caught in time.
+#define ADC_TEMP_TARGET_Q8 128
+#define ADC_TEMP_MIN_LOG2_RATIO 4
+#define ADC_TEMP_MAX_LOG2_RATIO 10
+uint8_t adcTempLog2Ratio = OVERSAMPLE_DEFAULT_LOG2_RATIO;
+
+void adc_adapt_ratio(){
+  const AdcWindow& window = adcBlock.window[ADC_CHANNEL_TEMP];
+  if(!window.sequence) return;
+  uint8_t log2Ratio = oversample_ratio_for(window.varianceQ8, ADC_TEMP_TARGET_Q8);
+  log2Ratio = constrain(log2Ratio, ADC_TEMP_MIN_LOG2_RATIO, ADC_TEMP_MAX_LOG2_RATIO);
+  if(log2Ratio != adcTempLog2Ratio){
+    adcTempLog2Ratio = log2Ratio;
+    hal_adc_ratio(ADC_CHANNEL_TEMP, log2Ratio);
+  }
+}
+
+// Set the H-bridge state
+void h_bridge_set(int hbrState){
+  switch (hbrState){
+    case A_POS: // Terminal A positive and Terminal B negative
+      hal_digital_write(HBR_AL, LOW);
+      hal_digital_write(HBR_AH, HIGH);
+      hal_digital_write(HBR_BL, HIGH);
+      hal_digital_write(HBR_BH, LOW);
+      break;
+    case B_POS: // Terminal B positive and Terminal A negative
+      hal_digital_write(HBR_AL, HIGH);
+      hal_digital_write(HBR_AH, LOW);
+      hal_digital_write(HBR_BL, LOW);
+      hal_digital_write(HBR_BH, HIGH);
+      break;
+    case OFF: // All MOSFETs off
+    default:
+      hal_digital_write(HBR_AL, LOW);
+      hal_digital_write(HBR_AH, LOW);
+      hal_digital_write(HBR_BL, LOW);
+      hal_digital_write(HBR_BH, LOW);
+  }  
+}
+
+// Sensor snapshot ------------------------------------------------------------------------------------------------------------------------
+
+Seqlock<SensorSnapshot> sensorSnapshot;
+
+// One reading of a disturbed window must not decide anything: the charge path sees medians, the reset check the full range
+MedianFilter<int16_t, 5> batteryMedian;
+MinMaxFilter<int16_t, 10> batteryRange;
+MedianFilter<int16_t, 5> temperatureMedian;
+Ema<int16_t, 6> temperatureAverage;       // about 0.64 s, the slope input
+SlopeFilter<int16_t, 60> temperatureTrend; // one sample per second
+uint32_t temperatureTrendLast = 0;
+MedianFilter<int, 3> proximityMedian;
+
+void sensors_publish(){
+  SensorSnapshot snapshot;
+  const AdcWindow& battery = adcBlock.window[ADC_CHANNEL_BATTERY];
+  const AdcWindow& temp = adcBlock.window[ADC_CHANNEL_TEMP];
+  int16_t batteryMv = adc_diff_mv(battery.sum, battery.log2Ratio);
+  batteryRange.update(batteryMv);
+  snapshot.batteryMv = batteryMedian.update(batteryMv);
+  snapshot.batteryMinMv = batteryRange.lowest();
+  snapshot.batteryMaxMv = batteryRange.highest();
+  snapshot.temperature = temperatureMedian.update(ntc_centi_celsius(temp.sum, temp.log2Ratio));
+  snapshot.proximity = proximity;
+  memcpy(snapshot.adc, adcBlock.window, sizeof(snapshot.adc));
+  snapshot.chargerDone = hal_digital_read(CHG_STAT) == HIGH;
+  snapshot.chargerTimer = hal_digital_read(CHG_TMR) == HIGH;
+  snapshot.timestamp = hal_millis();
+
+  temperatureAverage.update(snapshot.temperature);
+  if(snapshot.timestamp - temperatureTrendLast >= 1000){
+    temperatureTrendLast = snapshot.timestamp;
+    temperatureTrend.update(temperatureAverage.value());
+  }
+  snapshot.temperatureSlope = constrain(temperatureTrend.slope(60), INT16_MIN, INT16_MAX);
+  sensorSnapshot.write(snapshot);
+}
+
+// Move the servo towards target at one microsecond per msPerStep without blocking.
+// Returns true once the target is reached.
+uint32_t servoLastStep = 0;
+
+bool servo_move_to(int target, uint32_t msPerStep){
+  uint32_t now = hal_millis();
+  if(currentServoPos == target){
+    servoLastStep = now;
+    return true;
+  }
+  uint32_t steps = (now - servoLastStep) / msPerStep;
+  if(steps == 0) return false;
+  if(now - servoLastStep > 100) steps = 1; // motion (re)starts, don't jump
+  servoLastStep = now;
+  while(steps-- && currentServoPos != target){
+    currentServoPos += (target > currentServoPos) ? 1 : -1;
+  }
+  hal_servo_write(currentServoPos);
+  return currentServoPos == target;
+}
+
+// The proximity is the median of three passes 100 ms apart, after two more it only holds readings taken in IDLE
+#define IDLE_PROXIMITY_MS 200
+
+void fsm_idle(){ 
+  // keep the servo in the lowest position
+  if(!servo_move_to(LowerServoLimit, 3)) return;
+  // Check if a battery is in the feeder chute, never on what the sensor saw before the state was entered
+  SensorSnapshot sensors = sensorSnapshot.read();
+  if((int32_t)(sensors.timestamp - fsm_stateEntered) <= IDLE_PROXIMITY_MS) return;
+  if(sensors.proximity > proxThreshold ){
+    //battery detected!
+    fsm_set_state(FEED);
+  }
+}
+
+void fsm_feed(){
+  switch(fsm_subState){
+    case FEED_RAISE: // move the feeder arm up
+      if(servo_move_to(UpperServoLimit, 3)){
+        // Show status
+        event_post(EVT_LOADING);
+        fsm_set_substate(FEED_DROP);
+      }
+      break;
+    case FEED_DROP: // wait for the battery to drop into the feeder arm 
+      if(fsm_elapsed() >= 1000) fsm_set_state(CONTACT);
+      break;
+  }
+}
+
+// Throughput statistics, written by core 1
+ChargeStats chargeStats;
+uint32_t cellStart = 0; // hal_millis() when the current cell was detected, 0: no cell
+
+void charge_stats_reset_done(uint32_t ms, bool timeout){
+  chargeStats.resets++;
+  if(timeout) chargeStats.resetTimeouts++;
+  chargeStats.resetMsTotal += ms;
+  if(ms > chargeStats.resetMsMax) chargeStats.resetMsMax = ms;
+}
+
+// Contact qualification: once the arm is at the contact position, short ADC bursts on ADC_BAT_A/B are taken every pass
+// until the cell voltage is steady, then polarity and contact are decided right away instead of after a fixed wait.
+#define QUAL_MAX_NOISE_MV 20       // peak-to-peak within a burst
+#define QUAL_MAX_DRIFT_MV 10       // change of the mean between consecutive bursts
+#define QUAL_STABLE_BURSTS 3       // consecutive steady bursts before deciding
+#define QUAL_MIN_SETTLE_MS 20      // let the contacts stop bouncing
+#define QUAL_MAX_SETTLE_MS 500     // decide on the last burst if it never gets steady
+#define QUAL_MIN_MV 200            // below: no contact
+#define QUAL_MAX_MV 1400           // above: not a NiMH cell
+#define QUAL_ACCEPT_MIN_MS 50      // ignore CHG_STAT right after the H-bridge switched
+#define QUAL_ACCEPT_TIMEOUT_MS 3000 // stop waiting for the DS2712, SCREEN refuses the cell
+
+// A cell that shows no voltage is usually just badly seated. The arm backs off and re-approaches, trying positions around
+// ServoContactPos, before the cell is ejected.
+#define CONTACT_BACKOFF_US 30      // servo back-off towards the input chute
+const int contactRetryOffsets[] = {0, -10, 10}; // contact position offset per re-seat attempt
+const int CONTACT_RETRIES = sizeof(contactRetryOffsets) / sizeof(contactRetryOffsets[0]);
+
+// A burst is the latest window of the terminal difference, ADC_BLOCK_FRAMES frames within ADC_BLOCK_MS
+struct ContactBurst {
+  int16_t meanMv;     // V(A1) - V(A0)
+  int16_t noiseMv;    // peak-to-peak
+  uint32_t sequence;  // window
+};
+
+ContactBurst contact_burst(){
+  AdcBlock block;
+  hal_adc_block(block);
+  const AdcWindow& window = block.window[ADC_CHANNEL_BATTERY];
+  return {adc_diff_mv(window.sum, window.log2Ratio), adc_diff_mv(window.max - window.min, 0), window.sequence};
+}
+
+int contactAttempt = 0;     // re-seats done for the current cell
+int contactTarget = ServoContactPos;
+int16_t contactRestMv = 0;  // open-circuit cell voltage from the qualification
+bool chargerAccepted = false;
+int qualStableBursts = 0;
+int16_t qualLastMv = 0;
+uint32_t qualLastBlock = 0;
+uint32_t contactReached = 0; // hal_millis() when the arm reached the contact position
+
+void fsm_contact(){
+  switch(fsm_subState){
+    case CONTACT_LOWER: // move the feeder arm to to the middle
+      if(servo_move_to(contactTarget, 10)){
+        qualStableBursts = 0;
+        qualLastMv = INT16_MIN; // the first burst never counts as steady
+        if(contactAttempt == 0) contactReached = hal_millis();
+        fsm_set_substate(CONTACT_SETTLE);
+      }
+      break;
+
+    case CONTACT_SETTLE: {
+      if(fsm_elapsed() < QUAL_MIN_SETTLE_MS) break;
+      ContactBurst burst = contact_burst();
+      if(burst.sequence == qualLastBlock) break; // no new block since the last burst
+      qualLastBlock = burst.sequence;
+      bool steady = burst.noiseMv <= QUAL_MAX_NOISE_MV && abs(burst.meanMv - qualLastMv) <= QUAL_MAX_DRIFT_MV;
+      qualLastMv = burst.meanMv;
+      contactRestMv = abs(burst.meanMv);
+      qualStableBursts = steady ? qualStableBursts + 1 : 0;
+      if(qualStableBursts < QUAL_STABLE_BURSTS && fsm_elapsed() < QUAL_MAX_SETTLE_MS) break;
+
+      // no voltage, re-seat the cell while attempts are left
+      if(abs(burst.meanMv) < QUAL_MIN_MV && contactAttempt < CONTACT_RETRIES){
+        if(contactAttempt == 0) chargeStats.retriedCells++;
+        chargeStats.contactRetries++;
+        contactTarget = ServoContactPos + contactRetryOffsets[contactAttempt++];
+        fsm_set_substate(CONTACT_BACKOFF);
+        break;
+      }
+      // sanity check - proper battery voltage?
+      if(abs(burst.meanMv) < QUAL_MIN_MV || abs(burst.meanMv) > QUAL_MAX_MV){
+        event_post_fault(abs(burst.meanMv) < QUAL_MIN_MV ? FAULT_NO_CONTACT : FAULT_VOLTAGE);
+        fsm_set_state(ENDCHARGE);
+        break;
+      }
+      // the polarity sets the h-bridge accordingly
+      if(burst.meanMv >= 0){
+        hbrdge_currentState = A_POS;
+      }
+      else{
+        hbrdge_currentState = B_POS;
+      }    
+      h_bridge_set(hbrdge_currentState);
+      // turn off servo while charging
+      hal_servo_detach();
+      event_post(EVT_CHECKING);
+      fsm_set_substate(CONTACT_CHECK);
+      break;
+    }
+
+    case CONTACT_CHECK: { // wait for the charge IC to accept the battery, CHG_STAT goes low once it charges
+      SensorSnapshot sensors = sensorSnapshot.read();
+      bool accepted = (int32_t)(sensors.timestamp - fsm_stateStart) >= QUAL_ACCEPT_MIN_MS && !sensors.chargerDone;
+      if(accepted || fsm_elapsed() >= QUAL_ACCEPT_TIMEOUT_MS){
+        chargerAccepted = accepted;
+        fsm_set_state(SCREEN);
+      }
+      break;
+    }
+
+    case CONTACT_BACKOFF: // lift the arm a little, then approach again
+      if(servo_move_to(ServoContactPos + CONTACT_BACKOFF_US, 3)) fsm_set_substate(CONTACT_LOWER);
+      break;
+  }
+}
+
+// Cell screening: the DS2712 has started charging through the H-bridge, the voltage response to that current
+// shows cells that would only waste a charge cycle. NiMH cells rise by well under 150 mV at the fast charge current,
+// alkaline and worn cells with a high internal resistance by much more.
+#define SCREEN_LOAD_MS 500         // charge pulse before the loaded voltage is measured
+#define SCREEN_SHORT_MV 400        // loaded voltage below: internal short
+#define SCREEN_DEAD_MV 900         // rest and loaded voltage below: cell does not take charge
+#define SCREEN_MAX_RISE_MV 300     // loaded minus rest voltage above: alkaline or worn cell
+
+void fsm_screen(){
+  if(fsm_elapsed() < SCREEN_LOAD_MS) return;
+  int16_t loadMv = abs(contact_burst().meanMv);
+  int fault = -1;
+  if(!chargerAccepted || sensorSnapshot.read().chargerDone) fault = FAULT_REFUSED;
+  else if(loadMv < SCREEN_SHORT_MV) fault = FAULT_SHORTED;
+  else if(contactRestMv < SCREEN_DEAD_MV && loadMv < SCREEN_DEAD_MV) fault = FAULT_DEAD;
+  else if(loadMv - contactRestMv > SCREEN_MAX_RISE_MV) fault = FAULT_HIGH_RESISTANCE;
+
+  if(fault >= 0){
+    event_post_fault(fault);
+    fsm_set_state(ENDCHARGE);
+  }
+  else fsm_set_state(CHARGE);
+}
+
+// CHG_TMR toggles as long as the DS2712 charges. If it stops while CHG_STAT still reads "charging", the status line is
+// stuck and the charge has ended unseen.
+#define CHARGE_TIMER_STALL_MS 500
+
+uint32_t chargeLastProgress = 0;
+uint32_t chargeTimerEdge = 0;   // snapshot time of the last CHG_TMR edge
+bool chargeTimerLevel = false;
+uint32_t chargeStartClock = 0;  // wall clock when the charge started, kept across a reset
+uint32_t resumeChargedS = 0;    // charge time before the reset when a charge is resumed
+
+// Checkpoint ---------------------------------------------------------------------------------------------------------------------------
+// The state is written to flash on every transition and periodically while charging, so a reset mid-charge can resume
+// or eject the cell and the clock continues from the last record instead of the build-time default.
+
+#define CHECKPOINT_PERIOD_MS 600000 // while charging, for the clock and the charge time
+
+uint32_t checkpointLast = 0;
+Checkpoint resumeCheckpoint;
+bool resumeValid = false;
+
+void fsm_checkpoint(){
+  if(!hal_clock_running()) return; // core 0 has not set the clock yet
+  [[maybe_unused]] uint32_t clock = hal_clock(); // read in every mode, it is part of the trace
+  #if !defined(TRACE_REPLAY) && !defined(SIMULATION) // neither may overwrite the checkpoint of the unit
+  Checkpoint checkpoint = {(uint8_t)fsm_currentState, 0, (int16_t)currentServoPos, chargeStartClock, clock};
+  checkpoint_save(checkpoint);
+  #endif
+  checkpointLast = hal_millis();
+}
+
+void fsm_charge(){
+  boolean chargingOK = true;
+  SensorSnapshot sensors = sensorSnapshot.read();
+
+  // check if temperature is within limits
+  if(sensors.temperature > CHARGE_MAX_CENTI_C || sensors.temperature < CHARGE_MIN_CENTI_C){
+    chargingOK = false;
+  }
+
+  if(!chargingOK){
+    event_post_fault(FAULT_TEMPERATURE);
+    fsm_set_state(ENDCHARGE);
+    return;
+  }
+
+  // backstop behind the -dV termination of the DS2712: a full cell that is still charged, or a failing one, heats up fast
+  if(sensors.temperatureSlope > CHARGE_MAX_SLOPE){
+    event_post_fault(FAULT_TEMPERATURE_RISE);
+    fsm_set_state(ENDCHARGE);
+    return;
+  }
+
+  if(hal_millis() - checkpointLast >= CHECKPOINT_PERIOD_MS) fsm_checkpoint();
+
+  // report progress every 500 ms
+  if(hal_millis() - chargeLastProgress >= 500){
+    chargeLastProgress = hal_millis();
+    event_post(EVT_CHARGE_PROGRESS, sensors.batteryMv);
+  }
+  
+  // Detect end of charge or fault condition
+  if(sensors.chargerDone){
+    fsm_set_state(ENDCHARGE);
+    return;
+  }
+
+  if(sensors.chargerTimer != chargeTimerLevel){
+    chargeTimerLevel = sensors.chargerTimer;
+    chargeTimerEdge = sensors.timestamp;
+  }
+  else if((int32_t)(sensors.timestamp - chargeTimerEdge) >= CHARGE_TIMER_STALL_MS){
+    event_post_fault(FAULT_CHARGER_STATUS);
+    fsm_set_state(ENDCHARGE);
+  }
+}
+
+// Charger reset detection: after the eject the DS2712 is ready for the next cell once CHG_STAT reports not charging,
+// CHG_TMR has stopped toggling and the terminals are empty, all steady for CHARGER_RESET_STABLE_MS.
+// If the signals never settle the old fixed delay still applies as timeout.
+#define CHARGER_RESET_STABLE_MS 250
+#define CHARGER_RESET_MAX_MV 100     // terminal voltage with no cell between the contacts
+#define CHARGER_RESET_TIMEOUT_MS 5000
+
+uint32_t chargerQuietSince = 0;
+bool chargerTimerLevel = false;
+
+void fsm_endcharge(){
+  switch(fsm_subState){
+    case EJECT_LOWER: // move the servo to the lowest position
+      if(servo_move_to(LowerServoLimit, 3)){
+        fsm_set_substate(EJECT_RESET);
+        chargerQuietSince = 0;
+      }
+      break;
+
+    case EJECT_RESET: { // wait until the DS2712 charger has reset
+      SensorSnapshot sensors = sensorSnapshot.read();
+      if(fsm_elapsed() >= CHARGER_RESET_TIMEOUT_MS){
+        charge_stats_reset_done(fsm_elapsed(), true);
+        fsm_set_state(IDLE);
+        break;
+      }
+      if((int32_t)(sensors.timestamp - fsm_stateStart) < 0) break; // measured before the arm was down
+      bool quiet = sensors.chargerDone && sensors.batteryMaxMv < CHARGER_RESET_MAX_MV &&
+                   sensors.batteryMinMv > -CHARGER_RESET_MAX_MV;
+      if(!quiet || chargerQuietSince == 0 || sensors.chargerTimer != chargerTimerLevel){
+        // (re)start the stability window
+        chargerQuietSince = quiet ? hal_millis() : 0;
+        chargerTimerLevel = sensors.chargerTimer;
+      }
+      else if(hal_millis() - chargerQuietSince >= CHARGER_RESET_STABLE_MS){
+        charge_stats_reset_done(fsm_elapsed(), false);
+        fsm_set_state(IDLE);
+      }
+      break;
+    }
+  }
+}
+
+// Boot stages ----------------------------------------------------------------------------------------------------------------------------
+// charge_begin() only sets up the pins and the ADC, servo and sensor are brought up in the WAKEUP state, one stage per pass.
+
+void boot_servo(){
+  hal_servo_attach(currentServoPos);
+}
+
+void boot_sensor(){
+  hal_proximity_begin();
+  proximityReady = true;
+}
+
+struct BootStage {
+  const char* name;
+  void (*run)();
+};
+// Where to continue after a reset: a charge that was running is re-qualified and resumed, a cell that was being
+// handled is ejected. After a watchdog reset every cell is ejected, the hang could repeat.
+int fsm_resume_state(){
+  if(!resumeValid) return IDLE;
+  if(watchdog_caused_reboot() && resumeCheckpoint.state > IDLE) return ENDCHARGE;
+  switch(resumeCheckpoint.state){
+    case WAKEUP:
+    case IDLE:
+      return IDLE;
+    case CHARGE:
+      resumeChargedS = resumeCheckpoint.wallClock - resumeCheckpoint.chargeStart;
+      if(resumeCheckpoint.chargeStart && resumeChargedS < CHARGE_MAX_DWELL_MS / 1000) return CONTACT;
+      resumeChargedS = 0;
+      return ENDCHARGE;
+    default:
+      return ENDCHARGE;
+  }
+}
+
+const BootStage bootStages[] = {
+  {"servo", boot_servo},
+  {"sensor", boot_sensor},
+};
+const int BOOT_STAGE_COUNT = sizeof(bootStages) / sizeof(bootStages[0]);
+int bootStage = 0;
+
+void fsm_wakeup(){
+  bootStages[bootStage].run();
+  boot_phase(bootStages[bootStage].name);
+  if(++bootStage == BOOT_STAGE_COUNT){
+    int state = TRACE_INPUT(TRACE_RESUME, 0, fsm_resume_state());
+    resumeChargedS = TRACE_INPUT(TRACE_RESUME, 1, resumeChargedS);
+    fsm_set_state(state);
+  }
+}
+
+// Charge state machine -------------------------------------------------------------------------------------------------------------------
+// Every state is one row: its pass function, entry and exit actions, the longest time it may stay active and the states it may
+// go to. Dispatch indexes the table with the current state. A state that overstays its dwell time posts a timeout fault and
+// goes to its timeout state; transitions that are not in the table are refused.
+
+#define FSM_TO(state) (1U << (state))
+
+struct FsmState {
+  int state;                 // must equal the row index
+  const char* name;
+  void (*run)();             // called every pass of the charge task
+  void (*entry)();           // NULL: no action
+  void (*exit)();
+  uint32_t maxDwellMs;       // 0: unbounded, only for waiting on a cell
+  int timeoutState;
+  uint32_t transitions;      // FSM_TO() mask of allowed next states
+};
+
+void fsm_exit_wakeup(){
+  boot_done();
+}
+
+void fsm_entry_feed(){
+  cellStart = hal_millis();
+  event_post(EVT_CELL_DETECTED);
+}
+
+void fsm_entry_contact(){
+  contactAttempt = 0;
+  contactTarget = ServoContactPos;
+  hbrdge_currentState = OFF;
+  h_bridge_set(hbrdge_currentState);
+}
+
+void fsm_entry_charge(){
+  // a resumed charge keeps its start time, the backstop counts the time charged before the reset
+  chargeStartClock = hal_clock() - resumeChargedS;
+  fsm_stateEntered -= resumeChargedS * 1000;
+  resumeChargedS = 0;
+  chargeStats.contacts++;
+  chargeStats.contactMsTotal += hal_millis() - contactReached;
+  if(contactAttempt) chargeStats.retriedCharged++;
+  chargeLastProgress = hal_millis() - 500; // show the voltage right away
+  chargeTimerEdge = hal_millis();
+}
+
+// never leave the charge state with the H-bridge on
+void fsm_exit_charge(){
+  chargeStartClock = 0;
+  hbrdge_currentState = OFF;
+  h_bridge_set(hbrdge_currentState);
+}
+
+void fsm_entry_endcharge(){
+  event_post(EVT_EJECTING);
+  hal_servo_attach(currentServoPos);
+  hbrdge_currentState = OFF;
+  h_bridge_set(hbrdge_currentState);
+}
+
+void fsm_exit_endcharge(){
+  if(cellStart){
+    chargeStats.cells++;
+    chargeStats.cycleMsTotal += hal_millis() - cellStart;
+    cellStart = 0;
+  }
+  event_post(EVT_IDLE);
+}
+
+// Dwell times: the servo moves take (UpperServoLimit - LowerServoLimit) * 3 ms = 1.5 s and
+// (UpperServoLimit - ServoContactPos) * 10 ms = 2.8 s, the waits are 1 s (feed) and at most
+// QUAL_MAX_SETTLE_MS + QUAL_ACCEPT_TIMEOUT_MS = 3.5 s (contact). Each of the CONTACT_RETRIES re-seats adds
+// at most 0.1 s back-off, 0.4 s approach and QUAL_MAX_SETTLE_MS, 9.4 s for the whole contact state. The screening
+// takes SCREEN_LOAD_MS.
+// The eject reset wait is at most CHARGER_RESET_TIMEOUT_MS.
+// The DS2712 ends the charge on its own timer, the charge dwell time is only the backstop.
+constexpr FsmState fsmStates[] = {
+  //state      name         run             entry                 exit                 max dwell ms          on timeout  allowed next states
+  {WAKEUP,     "wakeup",    fsm_wakeup,     NULL,                 fsm_exit_wakeup,     1000,                 IDLE,       FSM_TO(IDLE) | FSM_TO(CONTACT) | FSM_TO(ENDCHARGE)},
+  {IDLE,       "idle",      fsm_idle,       NULL,                 NULL,                0,                    IDLE,       FSM_TO(FEED) | FSM_TO(ENDCHARGE)},
+  {FEED,       "feed",      fsm_feed,       fsm_entry_feed,       NULL,                5000,                 ENDCHARGE,  FSM_TO(CONTACT) | FSM_TO(ENDCHARGE)},
+  {CONTACT,    "contact",   fsm_contact,    fsm_entry_contact,    NULL,                12000,                ENDCHARGE,  FSM_TO(SCREEN) | FSM_TO(ENDCHARGE)},
+  {SCREEN,     "screen",    fsm_screen,     NULL,                 NULL,                1000,                 ENDCHARGE,  FSM_TO(CHARGE) | FSM_TO(ENDCHARGE)},
+  {CHARGE,     "charge",    fsm_charge,     fsm_entry_charge,     fsm_exit_charge,     CHARGE_MAX_DWELL_MS,  ENDCHARGE,  FSM_TO(ENDCHARGE)},
+  {ENDCHARGE,  "endcharge", fsm_endcharge,  fsm_entry_endcharge,  fsm_exit_endcharge,  10000,                IDLE,       FSM_TO(IDLE)},
+};
+static_assert(sizeof(fsmStates) / sizeof(fsmStates[0]) == FSM_STATE_COUNT, "one row per FSM_STATE");
+
+constexpr bool fsm_table_indexed(){
+  for(int i = 0; i < FSM_STATE_COUNT; i++){
+    if(fsmStates[i].state != i || !fsmStates[i].run) return false;
+  }
+  return true;
+}
+
+// every state can be left, and the timeout state is an allowed transition
+constexpr bool fsm_transitions_complete(){
+  for(int i = 0; i < FSM_STATE_COUNT; i++){
+    if((fsmStates[i].transitions & ~FSM_TO(i)) == 0) return false;
+    if(fsmStates[i].maxDwellMs && !(fsmStates[i].transitions & FSM_TO(fsmStates[i].timeoutState))) return false;
+  }
+  return true;
+}
+
+// only IDLE may wait forever
+constexpr bool fsm_dwell_bounded(){
+  for(int i = 0; i < FSM_STATE_COUNT; i++){
+    if(i != IDLE && fsmStates[i].maxDwellMs == 0) return false;
+  }
+  return true;
+}
+
+constexpr bool fsm_all_reachable(){
+  uint32_t reached = FSM_TO(WAKEUP);
+  for(int pass = 0; pass < FSM_STATE_COUNT; pass++){
+    for(int i = 0; i < FSM_STATE_COUNT; i++){
+      if(reached & FSM_TO(i)) reached |= fsmStates[i].transitions;
+    }
+  }
+  return reached == FSM_TO(FSM_STATE_COUNT) - 1;
+}
+
+static_assert(fsm_table_indexed(), "fsmStates rows must be in FSM_STATE order and have a run function");
+static_assert(fsm_transitions_complete(), "every state needs an exit and its timeout state must be an allowed transition");
+static_assert(fsm_dwell_bounded(), "every state except IDLE needs a maximum dwell time");
+static_assert(fsm_all_reachable(), "unreachable state in fsmStates");
+
+uint32_t fsmRefused = 0; // transitions refused by the table
+
+void fsm_set_state(int state){
+  const FsmState& from = fsmStates[fsm_currentState];
+  if(!(from.transitions & FSM_TO(state))){
+    fsmRefused++;
+    return;
+  }
+  if(from.exit) from.exit();
+  chargeStats.stateMs[fsm_currentState] += hal_millis() - fsm_stateEntered;
+  fsm_currentState = state;
+  fsm_stateEntered = hal_millis();
+  fsm_set_substate(0);
+  TRACE_OUTPUT(TRACE_STATE, 0, state);
+  fault_observe_state(state);
+  if(fsmStates[state].entry) fsmStates[state].entry();
+  fsm_checkpoint();
+}
+
+void fsm_run(){
+  const FsmState& current = fsmStates[fsm_currentState];
+  if(current.maxDwellMs && hal_millis() - fsm_stateEntered > current.maxDwellMs){
+    event_post_fault(FAULT_TIMEOUT);
+    fsm_set_state(current.timeoutState);
+  }
+  fsmStates[fsm_currentState].run();
+}
+
+#ifdef ADC_STATS
+// Latest window of every channel: ratio, resolution it is worth, variance and range of its samples
+void adc_stats_report(){
+  static const char* const names[ADC_CHANNELS] = {"battery", "ntc"};
+  SensorSnapshot sensors = sensorSnapshot.read();
+  for(int i = 0; i < ADC_CHANNELS; i++){
+    const AdcWindow& window = sensors.adc[i];
+    uint32_t variance = (uint64_t)window.varianceQ8 * 100 / 256;
+    Serial.printf("[adc] %s: %d samples, %d bits, variance %lu.%02lu LSB², min %d max %d\n", names[i],
+                  1 << window.log2Ratio, adc_window_bits(window), variance / 100, variance % 100, window.min, window.max);
+  }
+}
+#endif
+
+void charge_stats_report(){
+  ChargeStats stats = chargeStats; // copied while core 1 may update it, good enough for diagnostics
+  Serial.printf("[charge] %lu cells", stats.cells);
+  if(stats.cycleMsTotal) Serial.printf(", %.1f cells/h", stats.cells * 3600000.0 / stats.cycleMsTotal);
+  if(stats.contacts) Serial.printf(", contact check avg %lu ms", stats.contactMsTotal / stats.contacts);
+  if(stats.retriedCells) Serial.printf(", %lu re-seats on %lu cells, %lu charged",
+                                       stats.contactRetries, stats.retriedCells, stats.retriedCharged);
+  if(stats.resets) Serial.printf(", charger reset avg %lu ms max %lu ms, %lu of %lu by timeout",
+                                 stats.resetMsTotal / stats.resets, stats.resetMsMax, stats.resetTimeouts, stats.resets);
+  if(fsmRefused) Serial.printf(", %lu transitions refused", fsmRefused);
+  Serial.println();
+  if(stats.cells){
+    Serial.print("[charge] per cell:");
+    for(int i = IDLE; i < FSM_STATE_COUNT; i++) Serial.printf(" %s %lu ms", fsmStates[i].name, stats.stateMs[i] / stats.cells);
+    Serial.println();
+  }
+}
+
+// Fault injection ----------------------------------------------------------------------------------------------------------------------
+// Required reactions of the charge path to hardware faults, run by Serial command with FAULT_INJECTION (see fault_inject.h).
+// The temperature is checked on every charge pass and updated on every sensor pass. A stuck CHG_STAT low takes effect when
+// the DS2712 ends the charge, CHG_TMR stops then. A servo that does not move leaves the cell off the contacts, which the
+// qualification rejects after its re-seats.
+
+constexpr FaultScenario faultScenarios[] = {
+  //name             fault                  injected in  reaction          limit ms
+  {"ntc_open",       INJECT_NTC_OPEN,       CHARGE,      REACT_BRIDGE_OFF, 200},
+  {"ntc_short",      INJECT_NTC_SHORT,      CHARGE,      REACT_BRIDGE_OFF, 200},
+  {"chg_stat_high",  INJECT_CHG_STAT_HIGH,  CHARGE,      REACT_BRIDGE_OFF, 50},
+  {"chg_stat_low",   INJECT_CHG_STAT_LOW,   CHARGE,      REACT_BRIDGE_OFF, CHARGE_TIMER_STALL_MS + 100},
+  {"chg_stat_eject", INJECT_CHG_STAT_LOW,   ENDCHARGE,   REACT_LEAVE,      CHARGER_RESET_TIMEOUT_MS + 1000},
+  {"prox_i2c",       INJECT_PROXIMITY_I2C,  IDLE,        REACT_STAY,       10000},
+  {"servo_stuck",    INJECT_SERVO_STUCK,    CONTACT,     REACT_LEAVE,      10000},
+};
+const int FAULT_SCENARIO_COUNT = sizeof(faultScenarios) / sizeof(faultScenarios[0]);
+
+// a required reaction must come before the dwell backstop, which would hide a missing one
+constexpr bool fault_limits_within_dwell(){
+  for(int i = 0; i < FAULT_SCENARIO_COUNT; i++){
+    const FaultScenario& f = faultScenarios[i];
+    if(f.reaction != REACT_STAY && fsmStates[f.state].maxDwellMs && f.limitMs >= fsmStates[f.state].maxDwellMs) return false;
+  }
+  return true;
+}
+static_assert(fault_limits_within_dwell(), "a fault reaction limit reaches the dwell backstop of its state");
+
+// Tasks --------------------------------------------------------------------------------------------------------------------------------
+
+// Core 1 tasks that take inputs, numbered for the trace
+enum TRACED_TASK {TRACED_CHARGE, TRACED_SENSORS, TRACED_PROXIMITY};
+
+// Next command from the UI core, a replay takes them from the trace
+bool charge_command(uint8_t& command){
+  #ifdef TRACE_REPLAY
+  int32_t value;
+  if(!trace_replay_optional(TRACE_COMMAND, value)) return false;
+  command = value;
+  #else
+  if(!commandQueue.pop(command)) return false;
+  (void)TRACE_INPUT(TRACE_COMMAND, 0, command);
+  #endif
+  return true;
+}
+
+// Charge supervision: commands, servo and state machine
+void task_charge(){
+  TRACE_OUTPUT(TRACE_TASK, 0, TRACED_CHARGE);
+
+  // Commands from the UI core, the buttons are live before the charge path has finished booting (the table refuses the eject then)
+  uint8_t command;
+  while(charge_command(command)){
+    if(command == CMD_EJECT) fsm_set_state(ENDCHARGE);
+    if(command == CMD_CHECKPOINT && fsm_currentState != WAKEUP) fsm_checkpoint();
+    #ifdef ADC_CALIBRATION
+    if(command == CMD_SAVE_CALIBRATION) adc_cal_save();
+    #endif
+  }
+
+  // Update servo position
+  currentServoPos = constrain(currentServoPos, LowerServoLimit, UpperServoLimit);
+  hal_servo_write(currentServoPos);
+  
+  // Handle the state machine
+  fsm_run();
+}
+
+// Sample the cell and the charger and publish the snapshot
+void task_sensors(){
+  TRACE_OUTPUT(TRACE_TASK, 0, TRACED_SENSORS);
+  hal_adc_block(adcBlock);
+  adc_adapt_ratio();
+  sensors_publish();
+}
+
+void task_proximity(){
+  TRACE_OUTPUT(TRACE_TASK, 0, TRACED_PROXIMITY);
+  if(proximityReady) proximity = proximityMedian.update(hal_proximity());
+}
+
+#ifdef SIMULATION
+// The sensor and proximity tasks keep their periods in simulated time
+void charge_sim_step(){
+  sim_advance(SIM_STEP_MS);
+  uint32_t now = sim_millis();
+  if(now % 10 == 0) task_sensors();
+  if(now % 100 == 0) task_proximity();
+  task_charge();
+}
+
+// Run the charge path against the models in simulated time, as many steps as fit into the pass budget
+void task_sim(){
+  uint32_t start = micros();
+  while(micros() - start < SIM_PASS_BUDGET_US) charge_sim_step();
+}
+#endif
+
+#ifdef TRACE_REPLAY
+// Run the recorded task passes in their order, as many as have arrived and fit into the pass budget
+void task_replay(){
+  static void (*const tracedTasks[])() = {task_charge, task_sensors, task_proximity};
+  uint32_t start = micros();
+  int task;
+  while(micros() - start < TRACE_PASS_BUDGET_US && (task = trace_replay_next_task()) >= 0){
+    if(task < (int)(sizeof(tracedTasks) / sizeof(tracedTasks[0]))) tracedTasks[task]();
+    else trace_replay_output(TRACE_TASK, 0, -1); // not a task of this firmware, reported as the difference
+  }
+}
+#endif
+
+
+void charge_begin(){
+  // Proximity Sensor Interrupt
+  pinMode(VCN_INT, INPUT);
+
+  // H-Bridge Controls
+  pinMode(HBR_AL, OUTPUT);
+  pinMode(HBR_AH, OUTPUT);
+  pinMode(HBR_BL, OUTPUT);
+  pinMode(HBR_BH, OUTPUT);
+  pinMode(ADC_BAT_A, INPUT);
+  pinMode(ADC_BAT_B, INPUT);
+  pinMode(ADC_TEMP_BAT, INPUT);
+
+  // Charger
+  pinMode(CHG_STAT, INPUT_PULLUP);
+  pinMode(CHG_TMR, INPUT);
+  
+  // Servo
+  pinMode(PWM_SERVO, OUTPUT);
+
+  // Charger Init
+  h_bridge_set(OFF);
+
+  // ADC Init, free-running from here
+  hal_adc_begin();
+  boot_phase("io");
+
+  // Restore the last checkpoint, the servo holds its position until WAKEUP decides how to continue. The simulation
+  // starts with an empty charger, the records of the unit are not its own; a replay takes the decision from the trace.
+  #if !defined(SIMULATION) && !defined(TRACE_REPLAY)
+  resumeValid = checkpoint_load(resumeCheckpoint);
+  #endif
+  if(resumeValid) currentServoPos = constrain(resumeCheckpoint.servoPos, LowerServoLimit, UpperServoLimit);
+  boot_phase("checkpoint");
+
+  // a trace starts here, with the servo position the checkpoint left
+  trace_begin();
+  currentServoPos = TRACE_INPUT(TRACE_RESUME, 2, currentServoPos);
+
+  // servo and sensor follow in the WAKEUP state, its dwell time counts from here
+  fsm_stateEntered = hal_millis();
+}
@@ -0,0 +1,341 @@
+// Plant models for SIMULATION, see charger_sim.h
+
+#include "hal.h"
+#ifdef SIMULATION
+
+#include <math.h>
+#include "pins.h"
+#include "charger_sim.h"
+
+// Mechanics, the real arm positions the firmware servo constants are calibrated against
+#define ARM_LOAD_US 1665           // at or above: the arm takes the next cell from the input chute
+#define ARM_EJECT_US 1190          // at or below: the cell drops into the output chute
+#define ARM_CONTACT_US 1400        // centre of the contact window
+#define ARM_CONTACT_WINDOW_US 8
+#define ARM_SPEED_US_PER_MS 6.0    // servo slew rate
+#define CONTACT_BOUNCE_MS 15       // the terminals bounce after the arm enters the contact window
+#define CHUTE_REFILL_MS 400        // the next cell slides down after the arm took one
+
+// DS2712
+#define CHARGER_QUALIFY_MS 100
+#define CHARGER_RESET_MS 200       // the terminals must be open this long before the next cell is accepted
+#define CHARGER_FAST_MA 1000.0
+#define CHARGER_PRE_MA 100.0       // below 1 V
+#define CHARGER_TIMER_MS (4UL * 3600000)
+#define CHARGER_DV_MV 5.0          // -dV termination
+#define CHARGER_TMR_TOGGLE_MS 50   // timer oscillator half period
+
+// Measurement front end
+#define ADC_OFFSET 1000            // counts on both terminals with nothing connected
+#define ADC_MV_PER_LSB 1.612       // differential, 2 * 0.806 mV
+#define AMBIENT_C 25.0
+#define PROX_CELL 200
+#define PROX_EMPTY 10
+
+static const char* cellTypeNames[] = {"NiMH", "NiMH, poor contact", "alkaline", "dead", "shorted", "NiMH, heats up"};
+static_assert(sizeof(cellTypeNames) / sizeof(cellTypeNames[0]) == CELL_TYPE_COUNT, "one name per SIM_CELL_TYPE");
+
+struct Cell {
+  uint8_t type;
+  int8_t orientation;    // +1: V(A1) > V(A0), the firmware answers with A_POS
+  uint8_t seats;         // approaches of the arm before it makes contact
+  float capacityMah;
+  float soc;             // state of charge, above 1 when overcharged
+  float resistance;      // internal resistance in ohms
+  float temperature;     // °C
+};
+
+enum CHARGER_STATE {CHARGER_IDLE, CHARGER_QUALIFY, CHARGER_CHARGING, CHARGER_DONE};
+
+static struct {
+  uint32_t clock;        // simulated ms
+  uint32_t seed;
+  uint32_t realStart;
+
+  // arm and chutes
+  bool servoAttached;
+  int servoCommand;
+  float armUs;
+  int stack;             // cells above the one in the chute
+  int cellType;          // type of the cells put into the chute, CELL_TYPE_COUNT: the random mix
+  bool chuteOccupied;
+  Cell chute;
+  uint32_t refillAt;
+  bool armLoaded;
+  Cell cell;
+  bool inWindow;
+  uint32_t windowSince;
+  int approaches;
+
+  // H-bridge and charger
+  bool pins[4];          // HBR_AH, HBR_AL, HBR_BL, HBR_BH
+  int charger;
+  uint32_t chargerSince;
+  bool open;             // no cell on the charger output
+  uint32_t openSince;
+  float currentMa;
+  float peakMv;
+  AdcBlock adcBlock;     // latest block of the free-running ADC
+  Oversampler oversamplers[ADC_CHANNELS];
+
+  SimStats stats;
+} sim;
+
+static uint32_t sim_random(){
+  sim.seed = sim.seed * 1664525 + 1013904223;
+  return sim.seed >> 8;
+}
+
+static Cell cell_new(){
+  Cell c;
+  uint32_t r = sim_random() % 100;
+  c.type = r < 70 ? CELL_NIMH : r < 80 ? CELL_NIMH_MARGINAL : r < 88 ? CELL_ALKALINE : r < 95 ? CELL_DEAD : CELL_SHORTED;
+  if(sim.cellType != CELL_TYPE_COUNT) c.type = sim.cellType;
+  c.orientation = (sim_random() & 1) ? 1 : -1;
+  c.seats = c.type == CELL_NIMH_MARGINAL ? 2 : 1;
+  c.capacityMah = 1900 + sim_random() % 700;
+  c.soc = 0.05 + (sim_random() % 60) / 100.0;
+  switch(c.type){
+    case CELL_ALKALINE: c.resistance = 0.35; break;
+    case CELL_DEAD:     c.resistance = 0.6;  break;
+    case CELL_SHORTED:  c.resistance = 0.01; break;
+    default:            c.resistance = 0.03 + (sim_random() % 40) / 1000.0;
+  }
+  c.temperature = AMBIENT_C;
+  return c;
+}
+
+// Open-circuit voltage in mV
+static float cell_ocv(const Cell& c){
+  switch(c.type){
+    case CELL_ALKALINE: return 1350;
+    case CELL_DEAD:     return 500;
+    case CELL_SHORTED:  return 250;
+  }
+  if(c.soc < 0.1) return 1000 + 2000 * c.soc;           // 1.0 -> 1.2 V
+  if(c.soc < 0.9) return 1200 + 125 * (c.soc - 0.1);    // plateau up to 1.3 V
+  if(c.soc < 1.0) return 1300 + 1200 * (c.soc - 0.9);   // knee up to 1.42 V
+  return 1420 - 200 * (c.soc - 1.0);                    // -dV once overcharged
+}
+
+static bool cell_connected(){
+  return sim.armLoaded && sim.inWindow && sim.approaches >= sim.cell.seats;
+}
+
+// V(A1) - V(A0) in mV
+static float terminal_mv(){
+  if(!cell_connected()) return 0;
+  return (cell_ocv(sim.cell) + sim.currentMa * sim.cell.resistance) * sim.cell.orientation;
+}
+
+static int hbridge_state(){
+  bool ah = sim.pins[0], al = sim.pins[1], bl = sim.pins[2], bh = sim.pins[3];
+  if((ah && al) || (bh && bl)) return -1; // shoot-through
+  if(ah && bl) return 1;                  // A_POS
+  if(al && bh) return 2;                  // B_POS
+  return 0;
+}
+
+static void arm_step(uint32_t dt){
+  if(sim.servoAttached){
+    float step = ARM_SPEED_US_PER_MS * dt;
+    float diff = sim.servoCommand - sim.armUs;
+    sim.armUs += diff > step ? step : diff < -step ? -step : diff;
+  }
+
+  // the stack is refilled whenever it runs empty, the simulation never runs out of cells
+  if(!sim.chuteOccupied && (int32_t)(sim.clock - sim.refillAt) >= 0){
+    if(sim.stack == 0) sim.stack = SIM_STACK_CELLS;
+    sim.stack--;
+    sim.chute = cell_new();
+    sim.chuteOccupied = true;
+  }
+  if(sim.armUs >= ARM_LOAD_US && !sim.armLoaded && sim.chuteOccupied){
+    sim.cell = sim.chute;
+    sim.armLoaded = true;
+    sim.approaches = 0;
+    sim.chuteOccupied = false;
+    sim.refillAt = sim.clock + CHUTE_REFILL_MS;
+    sim.stats.fed[sim.cell.type]++;
+  }
+  if(sim.armUs <= ARM_EJECT_US && sim.armLoaded){
+    sim.armLoaded = false;
+    sim.stats.ejected[sim.cell.type]++;
+  }
+
+  bool inWindow = fabsf(sim.armUs - ARM_CONTACT_US) <= ARM_CONTACT_WINDOW_US;
+  if(inWindow && !sim.inWindow){
+    sim.approaches++;
+    sim.windowSince = sim.clock;
+  }
+  sim.inWindow = inWindow;
+}
+
+static void charger_step(uint32_t dt){
+  int bridge = hbridge_state();
+  if(bridge < 0) sim.stats.shootThroughMs += dt;
+  bool connected = cell_connected() && bridge > 0;
+
+  if(!connected){
+    sim.currentMa = 0;
+    if(!sim.open){
+      sim.open = true;
+      sim.openSince = sim.clock;
+    }
+    if(sim.charger != CHARGER_IDLE && sim.clock - sim.openSince >= CHARGER_RESET_MS) sim.charger = CHARGER_IDLE;
+    if(sim.charger == CHARGER_CHARGING || sim.charger == CHARGER_QUALIFY) sim.charger = CHARGER_DONE;
+  }
+  else{
+    sim.open = false;
+    bool polarityOk = (bridge == 1) == (sim.cell.orientation > 0);
+    switch(sim.charger){
+      case CHARGER_IDLE:
+        sim.charger = CHARGER_QUALIFY;
+        sim.chargerSince = sim.clock;
+        break;
+      case CHARGER_QUALIFY:
+        if(sim.clock - sim.chargerSince < CHARGER_QUALIFY_MS) break;
+        sim.charger = polarityOk ? CHARGER_CHARGING : CHARGER_DONE;
+        sim.chargerSince = sim.clock;
+        sim.peakMv = 0;
+        break;
+      case CHARGER_CHARGING: {
+        sim.currentMa = cell_ocv(sim.cell) < 1000 ? CHARGER_PRE_MA : CHARGER_FAST_MA;
+        float mv = fabsf(terminal_mv());
+        if(mv > sim.peakMv) sim.peakMv = mv;
+        bool dv = sim.cell.soc > 0.95 && sim.peakMv - mv >= CHARGER_DV_MV;
+        if(dv || sim.clock - sim.chargerSince >= CHARGER_TIMER_MS){
+          if(dv) sim.stats.charged[sim.cell.type]++;
+          sim.charger = CHARGER_DONE;
+          sim.currentMa = 0;
+        }
+        break;
+      }
+      case CHARGER_DONE:
+        sim.currentMa = 0;
+        break;
+    }
+  }
+
+  // the cell charges and warms up, most of the heat comes from overcharging
+  if(sim.armLoaded){
+    Cell& c = sim.cell;
+    c.soc += sim.currentMa * dt / 3600000.0 / c.capacityMah;
+    float heat = sim.currentMa > 0 && c.soc > 1.0 ? 0.02 : 0.0;   // °C per s
+    if(c.type == CELL_NIMH_HOT && sim.currentMa > 0) heat = 0.06;
+    c.temperature += (heat - (c.temperature - AMBIENT_C) / 600.0) * dt / 1000.0;
+  }
+}
+
+void sim_begin(uint32_t seed){
+  sim.seed = seed;
+  sim.clock = 0;
+  sim.realStart = millis();
+  sim.armUs = ARM_EJECT_US;
+  sim.servoCommand = ARM_EJECT_US;
+  sim.stack = SIM_STACK_CELLS;
+  sim.cellType = CELL_TYPE_COUNT;
+  sim.refillAt = 0;
+  sim.charger = CHARGER_IDLE;
+}
+
+void sim_advance(uint32_t ms){
+  sim.clock += ms;
+  arm_step(ms);
+  charger_step(ms);
+}
+
+void sim_cell_type(int type){
+  sim.cellType = type;
+}
+
+uint32_t sim_millis(){
+  return sim.clock;
+}
+
+uint32_t sim_clock(){
+  return SIM_CLOCK_START + sim.clock / 1000;
+}
+
+int sim_analog_read(uint8_t pin){
+  if(pin == ADC_BAT_A || pin == ADC_BAT_B){
+    int diff = lroundf(terminal_mv() / ADC_MV_PER_LSB);
+    int noise = (int)(sim_random() % 5) - 2;
+    if(cell_connected() && sim.clock - sim.windowSince < CONTACT_BOUNCE_MS) noise += (int)(sim_random() % 301) - 150;
+    int counts = pin == ADC_BAT_B ? ADC_OFFSET + diff - diff / 2 + noise : ADC_OFFSET - diff / 2;
+    return constrain(counts, 0, 4095);
+  }
+  if(pin == ADC_TEMP_BAT){
+    // NTC (10k, B 3380) against 10k, see ntc_centi_celsius()
+    float t = sim.armLoaded ? sim.cell.temperature : AMBIENT_C;
+    float r = 10000 * expf(3380 * (1 / (t + 273.15) - 1 / 298.15));
+    return lroundf(4096 * r / (r + 10000));
+  }
+  return 0;
+}
+
+// The terminals are sampled frame by frame, the NTC does not change within a block. Only the frames of blocks that are
+// read are simulated, a window longer than a block then spans more simulated time than on the hardware.
+void sim_adc_block(AdcBlock& block){
+  uint32_t sequence = sim.clock / ADC_BLOCK_MS + 1;
+  if(sim.adcBlock.sequence != sequence){
+    AdcBlock& b = sim.adcBlock;
+    int countsTemp = sim_analog_read(ADC_TEMP_BAT);
+    for(int i = 0; i < ADC_BLOCK_FRAMES; i++){
+      int countsA = sim_analog_read(ADC_BAT_A);
+      sim.oversamplers[ADC_CHANNEL_BATTERY].add(sim_analog_read(ADC_BAT_B) - countsA, b.window[ADC_CHANNEL_BATTERY]);
+      sim.oversamplers[ADC_CHANNEL_TEMP].add(countsTemp, b.window[ADC_CHANNEL_TEMP]);
+    }
+    b.sequence = sequence;
+  }
+  block = sim.adcBlock;
+}
+
+void sim_adc_ratio(int channel, uint8_t log2Ratio){
+  sim.oversamplers[channel].set_ratio(log2Ratio);
+}
+
+int sim_digital_read(uint8_t pin){
+  bool active = sim.charger == CHARGER_QUALIFY || sim.charger == CHARGER_CHARGING;
+  if(pin == CHG_STAT) return sim.charger == CHARGER_CHARGING ? LOW : HIGH;
+  if(pin == CHG_TMR) return active && (sim.clock / CHARGER_TMR_TOGGLE_MS) % 2;
+  return HIGH;
+}
+
+void sim_digital_write(uint8_t pin, int value){
+  switch(pin){
+    case HBR_AH: sim.pins[0] = value; break;
+    case HBR_AL: sim.pins[1] = value; break;
+    case HBR_BL: sim.pins[2] = value; break;
+    case HBR_BH: sim.pins[3] = value; break;
+  }
+}
+
+void sim_servo_attach(bool attached){
+  sim.servoAttached = attached;
+}
+
+void sim_servo_write(int us){
+  sim.servoCommand = us;
+}
+
+int sim_proximity(){
+  return sim.chuteOccupied ? PROX_CELL : PROX_EMPTY;
+}
+
+void sim_stats(SimStats& stats){
+  stats = sim.stats;
+}
+
+void sim_report(){
+  uint32_t real = millis() - sim.realStart;
+  Serial.printf("[sim] %lu s simulated in %lu s (%lux)", sim.clock / 1000, real / 1000, real ? sim.clock / real : 0);
+  if(sim.stats.shootThroughMs) Serial.printf(", H-bridge shoot-through for %lu ms", sim.stats.shootThroughMs);
+  Serial.println();
+  for(int i = 0; i < CELL_TYPE_COUNT; i++){
+    Serial.printf("[sim] %-20s fed %4lu  charged %4lu  ejected %4lu\n", cellTypeNames[i], sim.stats.fed[i],
+                  sim.stats.charged[i], sim.stats.ejected[i]);
+  }
+}
+
+#endif // SIMULATION
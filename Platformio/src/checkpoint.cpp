@@ -0,0 +1,237 @@
+// Power-fail-safe checkpoint in flash, see checkpoint.h
+
+#include <string.h>
+#include <hardware/flash.h>
+#include <hardware/watchdog.h>
+#include "checkpoint.h"
+
+#define CHECKPOINT_SECTORS 2
+#define CHECKPOINT_SLOT_SIZE 32
+#define CHECKPOINT_SLOTS ((int)(FLASH_SECTOR_SIZE / CHECKPOINT_SLOT_SIZE))
+#define CHECKPOINT_EMPTY 0xFFFFFFFF // erased flash
+#define CALIBRATION_SECTOR CHECKPOINT_SECTORS
+#define CALIBRATION_MAGIC 0x4C414341 // "ACAL"
+
+struct Slot {
+  uint32_t sequence;
+  Checkpoint data;
+  uint32_t crc;
+};
+static_assert(sizeof(Slot) <= CHECKPOINT_SLOT_SIZE, "checkpoint record does not fit its slot");
+static_assert(FLASH_PAGE_SIZE % CHECKPOINT_SLOT_SIZE == 0, "slots must not straddle flash pages");
+
+struct CalibrationRecord {
+  uint32_t magic;
+  AdcCalibration data;
+  uint32_t crc;
+};
+static_assert(sizeof(CalibrationRecord) <= FLASH_PAGE_SIZE, "calibration record must fit one flash page");
+
+// Reserved by the linker as the filesystem area
+extern uint8_t _FS_start;
+extern uint8_t _FS_end;
+
+// Write position, only used by the saving core
+static bool positionKnown = false;
+static int nextSector = 0;
+static int nextSlot = 0;
+static uint32_t nextSequence = 1;
+
+// Flash stall, read by the watchdog on either core
+static volatile bool flashBusy = false;
+static volatile bool flashUsed = false;
+static volatile uint32_t flashEndMs = 0;
+
+static uint32_t flash_offset(int sector){
+  return (uint32_t)((uintptr_t)&_FS_start - XIP_BASE) + sector * FLASH_SECTOR_SIZE;
+}
+
+static const Slot* slot_at(int sector, int slot){
+  return (const Slot*)(&_FS_start + sector * FLASH_SECTOR_SIZE + slot * CHECKPOINT_SLOT_SIZE);
+}
+
+static uint32_t crc32(const uint8_t* data, size_t length){
+  uint32_t crc = 0xFFFFFFFF;
+  while(length--){
+    crc ^= *data++;
+    for(int i = 0; i < 8; i++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint32_t slot_crc(const Slot& slot){
+  return crc32((const uint8_t*)&slot, offsetof(Slot, crc));
+}
+
+static bool slot_valid(const Slot* slot){
+  return slot->sequence != CHECKPOINT_EMPTY && slot->crc == slot_crc(*slot);
+}
+
+static bool slot_empty(const Slot* slot){
+  const uint8_t* bytes = (const uint8_t*)slot;
+  for(int i = 0; i < CHECKPOINT_SLOT_SIZE; i++){
+    if(bytes[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+// Newest valid slot, NULL if there is none
+static const Slot* find_latest(int* sector, int* slot){
+  const Slot* latest = NULL;
+  for(int s = 0; s < CHECKPOINT_SECTORS; s++){
+    for(int i = 0; i < CHECKPOINT_SLOTS; i++){
+      const Slot* candidate = slot_at(s, i);
+      if(slot_valid(candidate) && (!latest || candidate->sequence > latest->sequence)){
+        latest = candidate;
+        *sector = s;
+        *slot = i;
+      }
+    }
+  }
+  return latest;
+}
+
+// The other core executes from flash as well, it has to wait while flash is busy. Nobody feeds the hardware watchdog
+// meanwhile, reload it for the longest stall; the counter runs at twice the tick rate (RP2040-E1), as in watchdog_enable().
+static void flash_stall_begin(){
+  flashBusy = true;
+  rp2040.idleOtherCore();
+  if(watchdog_hw->ctrl & WATCHDOG_CTRL_ENABLE_BITS) watchdog_hw->load = CHECKPOINT_STALL_MAX_MS * 1000 * 2;
+  noInterrupts();
+}
+
+static void flash_stall_end(){
+  interrupts();
+  rp2040.resumeOtherCore();
+  flashEndMs = millis();
+  flashUsed = true;
+  flashBusy = false;
+}
+
+bool checkpoint_flash_stalled(uint32_t graceMs){
+  return flashBusy || (flashUsed && millis() - flashEndMs < graceMs);
+}
+
+static void flash_erase(int sector){
+  flash_stall_begin();
+  flash_range_erase(flash_offset(sector), FLASH_SECTOR_SIZE);
+  flash_stall_end();
+}
+
+// Program one page, the bytes left at 0xFF do not change what is already written there
+static void flash_program_page(int sector, int pageStart, const void* data, size_t length, int offset){
+  uint8_t page[FLASH_PAGE_SIZE];
+  memset(page, 0xFF, sizeof(page));
+  memcpy(page + offset, data, length);
+
+  flash_stall_begin();
+  flash_range_program(flash_offset(sector) + pageStart, page, FLASH_PAGE_SIZE);
+  flash_stall_end();
+}
+
+static void flash_program_slot(int sector, int slot, const Slot& record){
+  int pageStart = slot * CHECKPOINT_SLOT_SIZE / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE;
+  flash_program_page(sector, pageStart, &record, sizeof(record), slot * CHECKPOINT_SLOT_SIZE - pageStart);
+}
+
+bool checkpoint_load(Checkpoint& checkpoint){
+  int sector, slot;
+  const Slot* latest = find_latest(&sector, &slot);
+  if(!latest) return false;
+  checkpoint = latest->data;
+  return true;
+}
+
+bool checkpoint_save(const Checkpoint& checkpoint){
+  if((uint32_t)(&_FS_end - &_FS_start) < CHECKPOINT_SECTORS * FLASH_SECTOR_SIZE) return false;
+
+  if(!positionKnown){
+    int sector = 0, slot = -1;
+    const Slot* latest = find_latest(&sector, &slot);
+    nextSector = sector;
+    nextSlot = slot + 1;
+    nextSequence = latest ? latest->sequence + 1 : 1;
+    positionKnown = true;
+  }
+
+  // skip slots left behind by an interrupted write, start over in the other sector when full
+  while(nextSlot < CHECKPOINT_SLOTS && !slot_empty(slot_at(nextSector, nextSlot))) nextSlot++;
+  if(nextSlot == CHECKPOINT_SLOTS){
+    nextSector = (nextSector + 1) % CHECKPOINT_SECTORS;
+    nextSlot = 0;
+    flash_erase(nextSector);
+  }
+
+  Slot record;
+  memset(&record, 0, sizeof(record));
+  record.sequence = nextSequence;
+  record.data = checkpoint;
+  record.crc = slot_crc(record);
+  flash_program_slot(nextSector, nextSlot, record);
+
+  bool written = slot_valid(slot_at(nextSector, nextSlot));
+  nextSlot++;
+  if(written) nextSequence++;
+  return written;
+}
+
+static const CalibrationRecord* calibration_record(){
+  return (const CalibrationRecord*)(&_FS_start + CALIBRATION_SECTOR * FLASH_SECTOR_SIZE);
+}
+
+static uint32_t calibration_crc(const CalibrationRecord& record){
+  return crc32((const uint8_t*)&record, offsetof(CalibrationRecord, crc));
+}
+
+static bool calibration_fits(){
+  return (uint32_t)(&_FS_end - &_FS_start) >= (CALIBRATION_SECTOR + 1) * FLASH_SECTOR_SIZE;
+}
+
+bool checkpoint_load_calibration(AdcCalibration& calibration){
+  if(!calibration_fits()) return false;
+  const CalibrationRecord* record = calibration_record();
+  if(record->magic != CALIBRATION_MAGIC || record->crc != calibration_crc(*record)) return false;
+  calibration = record->data;
+  return true;
+}
+
+bool checkpoint_save_calibration(const AdcCalibration& calibration){
+  if(!calibration_fits()) return false;
+  CalibrationRecord record;
+  memset(&record, 0, sizeof(record));
+  record.magic = CALIBRATION_MAGIC;
+  record.data = calibration;
+  record.crc = calibration_crc(record);
+  flash_erase(CALIBRATION_SECTOR);
+  flash_program_page(CALIBRATION_SECTOR, 0, &record, sizeof(record), 0);
+  return memcmp(calibration_record(), &record, sizeof(record)) == 0;
+}
+
+// Days since 2000-01-01, valid for 2000-2099
+static uint32_t days_from_date(int year, int month, int day){
+  static const uint16_t daysBeforeMonth[] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  int y = year - 2000;
+  uint32_t days = y * 365 + (y + 3) / 4 + daysBeforeMonth[month - 1] + day - 1;
+  if(month > 2 && y % 4 == 0) days++;
+  return days;
+}
+
+uint32_t checkpoint_clock(const datetime_t& dt){
+  return days_from_date(dt.year, dt.month, dt.day) * 86400 + dt.hour * 3600 + dt.min * 60 + dt.sec;
+}
+
+void checkpoint_datetime(uint32_t clock, datetime_t& dt){
+  uint32_t days = clock / 86400;
+  uint32_t seconds = clock % 86400;
+  dt.dotw = (days + 6) % 7; // 2000-01-01 was a Saturday
+  int year = 2000;
+  while(days >= days_from_date(year + 1, 1, 1)) year++;
+  int month = 1;
+  while(month < 12 && days >= days_from_date(year, month + 1, 1)) month++;
+  dt.year = year;
+  dt.month = month;
+  dt.day = days - days_from_date(year, month, 1) + 1;
+  dt.hour = seconds / 3600;
+  dt.min = seconds / 60 % 60;
+  dt.sec = seconds % 60;
+}
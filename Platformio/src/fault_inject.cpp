@@ -0,0 +1,207 @@
+// Fault injection at the hardware access layer, see fault_inject.h
+
+#include "fault_inject.h"
+
+#ifdef FAULT_INJECTION
+
+#include <atomic>
+#include "pins.h"
+#ifdef SIMULATION
+#include "charger_sim.h"
+#endif
+
+#define FAULT_LINE_SIZE 40
+
+enum FAULT_PHASE {PHASE_IDLE, PHASE_ARMED, PHASE_ACTIVE, PHASE_REACTED};
+
+// Written by core 0 before it arms, read by core 1
+static FaultScenario scenario;
+// Armed and cleared by core 0, activated and reacted by core 1. A clear racing with a reaction is only reported once
+// more, good enough for a bench session.
+static std::atomic<int> phase{PHASE_IDLE};
+static std::atomic<int> activeFault{INJECT_NONE};
+
+// Written by core 1
+static uint32_t activatedAt = 0;
+static uint32_t effectiveAt = 0;  // the fault first changed a reading or a write
+static std::atomic<bool> effective{false};
+static bool agreed = false;       // a reading under the fault matched the hardware before
+static uint32_t reactedAt = 0;
+static uint8_t bridgePins = 0; // levels of AH, AL, BH, BL
+
+// Written by core 0
+static bool effectReported = false;
+
+// Core 0 command line
+static char line[FAULT_LINE_SIZE];
+static int lineLength = 0;
+
+// Untraced time, the layer must not show up in a recording
+static uint32_t fault_now(){
+#ifdef SIMULATION
+  return sim_millis();
+#else
+  return millis();
+#endif
+}
+
+static bool injected(int fault){
+  return activeFault.load(std::memory_order_relaxed) == fault;
+}
+
+static bool bridge_on(){
+  const uint8_t aPos = 1 << 0 | 1 << 3; // AH and BL
+  const uint8_t bPos = 1 << 1 | 1 << 2; // AL and BH
+  return (bridgePins & aPos) == aPos || (bridgePins & bPos) == bPos;
+}
+
+// Called for every reading or write the injected fault applies to. A stuck signal that agrees with the hardware does
+// nothing yet, the reaction time then counts from the first difference instead of the injection.
+static void takes_effect(bool differs){
+  if(effective.load(std::memory_order_relaxed) || phase.load(std::memory_order_acquire) != PHASE_ACTIVE) return;
+  if(!differs){
+    agreed = true;
+    return;
+  }
+  effectiveAt = agreed ? fault_now() : activatedAt;
+  effective.store(true, std::memory_order_release);
+}
+
+static void react(){
+  reactedAt = fault_now();
+  phase.store(PHASE_REACTED, std::memory_order_release);
+}
+
+// Readings and writes ------------------------------------------------------------------------------------------------------------------
+
+void fault_adc_block(AdcBlock& block){
+  AdcWindow& window = block.window[ADC_CHANNEL_TEMP];
+  AdcWindow real = window;
+  if(injected(INJECT_NTC_OPEN)) window = {window.sequence, 4095 << window.log2Ratio, 0, 4095, 4095, window.log2Ratio};
+  else if(injected(INJECT_NTC_SHORT)) window = {window.sequence, 0, 0, 0, 0, window.log2Ratio};
+  else return;
+  takes_effect(window.sum != real.sum);
+}
+
+int fault_digital(uint8_t pin, int value){
+  if(pin != CHG_STAT) return value;
+  int faulty = injected(INJECT_CHG_STAT_HIGH) ? HIGH : injected(INJECT_CHG_STAT_LOW) ? LOW : value;
+  if(injected(INJECT_CHG_STAT_HIGH) || injected(INJECT_CHG_STAT_LOW)) takes_effect(faulty != value);
+  return faulty;
+}
+
+bool fault_proximity_begin(bool ok){
+  if(!injected(INJECT_PROXIMITY_I2C)) return ok;
+  takes_effect(ok);
+  return false;
+}
+
+int fault_proximity(int value){
+  if(!injected(INJECT_PROXIMITY_I2C)) return value;
+  takes_effect(value != 0);
+  return 0;
+}
+
+bool fault_servo_stuck(){
+  if(!injected(INJECT_SERVO_STUCK)) return false;
+  takes_effect(true); // the write is lost
+  return true;
+}
+
+void fault_observe_write(uint8_t pin, int value){
+  int bit = pin == HBR_AH ? 0 : pin == HBR_AL ? 1 : pin == HBR_BH ? 2 : pin == HBR_BL ? 3 : -1;
+  if(bit < 0) return;
+  bool wasOn = bridge_on();
+  bridgePins = value ? bridgePins | 1 << bit : bridgePins & ~(1 << bit);
+  if(wasOn && !bridge_on() && phase.load(std::memory_order_acquire) == PHASE_ACTIVE && scenario.reaction == REACT_BRIDGE_OFF){
+    react();
+  }
+}
+
+void fault_observe_state(int state){
+  int current = phase.load(std::memory_order_acquire);
+  if(current == PHASE_ARMED && state == scenario.state){
+    activatedAt = fault_now();
+    agreed = false;
+    effective.store(false, std::memory_order_relaxed);
+    activeFault.store(scenario.fault, std::memory_order_relaxed);
+    phase.store(PHASE_ACTIVE, std::memory_order_release);
+    if(scenario.reaction == REACT_BRIDGE_OFF && !bridge_on()) react();
+  }
+  else if(current == PHASE_ACTIVE && state != scenario.state && scenario.reaction != REACT_BRIDGE_OFF){
+    react();
+  }
+}
+
+// Commands and verdicts ----------------------------------------------------------------------------------------------------------------
+
+static void fault_command(const FaultScenario* scenarios, int count){
+  if(strncmp(line, "fault", 5) != 0) return;
+  const char* name = line + 5;
+  while(*name == ' ') name++;
+
+  if(!*name){
+    Serial.print("[fault] scenarios:");
+    for(int i = 0; i < count; i++) Serial.printf(" %s", scenarios[i].name);
+    Serial.println();
+    return;
+  }
+  if(strcmp(name, "clear") == 0){
+    phase.store(PHASE_IDLE, std::memory_order_release);
+    activeFault.store(INJECT_NONE, std::memory_order_relaxed);
+    Serial.println("[fault] cleared");
+    return;
+  }
+  for(int i = 0; i < count; i++){
+    if(strcmp(name, scenarios[i].name) != 0) continue;
+    if(phase.load(std::memory_order_acquire) != PHASE_IDLE){
+      Serial.printf("[fault] %s is still running, clear it first\n", scenario.name);
+      return;
+    }
+    scenario = scenarios[i];
+    effectReported = false;
+    phase.store(PHASE_ARMED, std::memory_order_release);
+    Serial.printf("[fault] %s armed\n", name);
+    return;
+  }
+  Serial.printf("[fault] unknown scenario %s\n", name);
+}
+
+static void fault_verdict(bool ok, const char* what, uint32_t ms){
+  Serial.printf("[fault] %s: %s %lu ms, %s %lu ms - %s\n", scenario.name, what, ms,
+                scenario.reaction == REACT_STAY ? "minimum" : "limit", scenario.limitMs, ok ? "ok" : "FAILED");
+  activeFault.store(INJECT_NONE, std::memory_order_relaxed);
+  phase.store(PHASE_IDLE, std::memory_order_release);
+}
+
+void fault_poll(const FaultScenario* scenarios, int count){
+  while(Serial.available()){
+    char c = Serial.read();
+    if(c == '\n' || c == '\r'){
+      line[lineLength] = 0;
+      if(lineLength) fault_command(scenarios, count);
+      lineLength = 0;
+    }
+    else if(lineLength < FAULT_LINE_SIZE - 1) line[lineLength++] = c;
+  }
+
+  // until the fault takes effect it is timed from the injection
+  int current = phase.load(std::memory_order_acquire);
+  bool inEffect = effective.load(std::memory_order_acquire);
+  uint32_t since = inEffect ? effectiveAt : activatedAt;
+  if(current == PHASE_ACTIVE && inEffect && !effectReported){
+    effectReported = true;
+    if(effectiveAt != activatedAt) Serial.printf("[fault] %s: in effect %lu ms after the injection\n", scenario.name, effectiveAt - activatedAt);
+  }
+  if(current == PHASE_REACTED){
+    uint32_t ms = reactedAt - since;
+    if(scenario.reaction == REACT_STAY) fault_verdict(ms >= scenario.limitMs, "left the state after", ms);
+    else fault_verdict(ms <= scenario.limitMs, scenario.reaction == REACT_BRIDGE_OFF ? "H-bridge off after" : "left the state after", ms);
+  }
+  else if(current == PHASE_ACTIVE && inEffect && fault_now() - since > scenario.limitMs){
+    uint32_t ms = fault_now() - since;
+    fault_verdict(scenario.reaction == REACT_STAY, scenario.reaction == REACT_STAY ? "stayed" : "no reaction after", ms);
+  }
+}
+
+#endif
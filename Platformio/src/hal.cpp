@@ -0,0 +1,147 @@
+// Hardware access of the charge path, see hal.h
+
+#include <Servo.h>
+#include <Adafruit_VCNL4040.h>
+#include "pins.h"
+#include "hal.h"
+#include "trace.h"
+#include "fault_inject.h"
+#include "adc_dma.h"
+#ifdef SIMULATION
+#include "charger_sim.h"
+#else
+#include <hardware/rtc.h>
+#include "checkpoint.h"
+#endif
+
+#if !defined(SIMULATION) && !defined(TRACE_REPLAY)
+static Servo servo;
+static Adafruit_VCNL4040 vcnl4040;
+#endif
+
+// Inputs pass the fault injection and are then recorded or replayed through TRACE_INPUT (the ADC block through
+// trace_adc_block()), a replay does not evaluate the read. Outputs are recorded or compared through TRACE_OUTPUT and not
+// carried out in a replay.
+
+uint32_t hal_millis(){
+#ifdef SIMULATION
+  return TRACE_TIME_INPUT(sim_millis());
+#else
+  return TRACE_TIME_INPUT(millis());
+#endif
+}
+
+#if !defined(SIMULATION) && !defined(TRACE_REPLAY)
+static uint32_t rtc_clock(){
+  datetime_t now;
+  rtc_get_datetime(&now);
+  return checkpoint_clock(now);
+}
+#endif
+
+bool hal_clock_running(){
+#ifdef SIMULATION
+  return TRACE_INPUT(TRACE_CLOCK, 0, true);
+#else
+  return TRACE_INPUT(TRACE_CLOCK, 0, rtc_running());
+#endif
+}
+
+uint32_t hal_clock(){
+#ifdef SIMULATION
+  return TRACE_INPUT(TRACE_CLOCK, 1, sim_clock());
+#else
+  return TRACE_INPUT(TRACE_CLOCK, 1, rtc_clock());
+#endif
+}
+
+void hal_adc_begin(){
+#if !defined(SIMULATION) && !defined(TRACE_REPLAY)
+  adc_dma_begin();
+#endif
+}
+
+void hal_adc_block(AdcBlock& block){
+#if defined(TRACE_REPLAY)
+  block = {};
+#elif defined(SIMULATION)
+  sim_adc_block(block);
+#else
+  adc_dma_block(block);
+#endif
+  fault_adc_block(block);
+  trace_adc_block(block);
+}
+
+void hal_adc_ratio(int channel, uint8_t log2Ratio){
+  TRACE_OUTPUT(TRACE_RATIO, channel, log2Ratio);
+#if defined(SIMULATION)
+  sim_adc_ratio(channel, log2Ratio);
+#elif !defined(TRACE_REPLAY)
+  adc_dma_ratio(channel, log2Ratio);
+#endif
+}
+
+int hal_digital_read(uint8_t pin){
+#ifdef SIMULATION
+  return TRACE_INPUT(TRACE_DIGITAL, pin, fault_digital(pin, sim_digital_read(pin)));
+#else
+  return TRACE_INPUT(TRACE_DIGITAL, pin, fault_digital(pin, digitalRead(pin)));
+#endif
+}
+
+void hal_digital_write(uint8_t pin, int value){
+  TRACE_OUTPUT(TRACE_WRITE, pin, value);
+  fault_observe_write(pin, value);
+#if defined(SIMULATION)
+  sim_digital_write(pin, value);
+#elif !defined(TRACE_REPLAY)
+  digitalWrite(pin, value);
+#endif
+}
+
+void hal_servo_attach(int us){
+  TRACE_OUTPUT(TRACE_ATTACH, 0, us);
+#if defined(SIMULATION)
+  sim_servo_write(us);
+  sim_servo_attach(true);
+#elif !defined(TRACE_REPLAY)
+  servo.writeMicroseconds(us);
+  servo.attach(PWM_SERVO);
+#endif
+}
+
+void hal_servo_detach(){
+  TRACE_OUTPUT(TRACE_ATTACH, 0, 0);
+#if defined(SIMULATION)
+  sim_servo_attach(false);
+#elif !defined(TRACE_REPLAY)
+  servo.detach();
+#endif
+}
+
+void hal_servo_write(int us){
+  TRACE_OUTPUT(TRACE_SERVO, 0, us);
+  if(fault_servo_stuck()) return;
+#if defined(SIMULATION)
+  sim_servo_write(us);
+#elif !defined(TRACE_REPLAY)
+  servo.writeMicroseconds(us);
+#endif
+}
+
+bool hal_proximity_begin(){
+#ifdef SIMULATION
+  return TRACE_INPUT(TRACE_SENSOR, 0, fault_proximity_begin(true));
+#else
+  return TRACE_INPUT(TRACE_SENSOR, 0, fault_proximity_begin((Wire.begin(), vcnl4040.begin())));
+#endif
+}
+
+int hal_proximity(){
+#ifdef SIMULATION
+  return TRACE_INPUT(TRACE_PROXIMITY, 0, fault_proximity(sim_proximity()));
+#else
+  return TRACE_INPUT(TRACE_PROXIMITY, 0, fault_proximity(vcnl4040.getProximity()));
+#endif
+}
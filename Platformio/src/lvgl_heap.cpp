@@ -0,0 +1,347 @@
+// Instrumented LVGL allocator, see lvgl_heap.h
+
+#include <Arduino.h>
+#include <lvgl.h>
+#include "lvgl_heap.h"
+#include "sram_layout.h"
+
+static lvgl_heap_stats_t stats;
+
+static void count_alloc(uint32_t size){
+  stats.used += size;
+  stats.blocks++;
+  stats.allocs++;
+  if(stats.used > stats.peak) stats.peak = stats.used;
+
+  int bin = 0;
+  while(bin < LVGL_HEAP_SIZE_BINS - 1 && size > (16U << bin)) bin++;
+  stats.size_bins[bin]++;
+}
+
+static void count_free(uint32_t size){
+  stats.used -= size;
+  stats.blocks--;
+  stats.frees++;
+}
+
+#if LVGL_HEAP_TLSF
+
+// Two-level segregated fit pool. The first level splits block sizes into powers of two, the
+// second level splits every power of two into SL_COUNT linear ranges. Both levels have a
+// bitmap, so finding a free list that fits is two bit scans and never a list walk.
+
+#define ALIGN_SIZE 4
+#define SL_LOG2 4
+#define SL_COUNT (1 << SL_LOG2)
+#define FL_SHIFT (SL_LOG2 + 2)              // sizes below 1 << FL_SHIFT share the first row
+#define SMALL_BLOCK (1U << FL_SHIFT)
+#define FL_MAX 17                            // largest block: 128 kB
+#define FL_COUNT (FL_MAX - FL_SHIFT + 1)
+
+#define BLOCK_FREE 1U
+#define BLOCK_SIZE_MASK (~3U)
+
+// Every block starts with this header. The free list links live in the payload, so a block
+// needs at least MIN_PAYLOAD bytes.
+struct Block {
+  Block* prevPhys;   // physically preceding block, NULL for the first one
+  uint32_t size;     // payload size | BLOCK_FREE
+  Block* nextFree;   // only valid while free
+  Block* prevFree;
+};
+
+#define HEADER_SIZE (offsetof(Block, nextFree))
+#define MIN_PAYLOAD (sizeof(Block) - HEADER_SIZE)
+
+static_assert(LVGL_HEAP_SIZE <= (1U << FL_MAX), "LVGL_HEAP_SIZE exceeds the largest TLSF class");
+static_assert(HEADER_SIZE % ALIGN_SIZE == 0, "block header breaks payload alignment");
+
+SRAM_LV_POOL static uint8_t pool[LVGL_HEAP_SIZE] __attribute__((aligned(ALIGN_SIZE)));
+static Block* freeLists[FL_COUNT][SL_COUNT];
+static uint32_t flBitmap;
+static uint32_t slBitmap[FL_COUNT];
+static bool poolReady = false;
+
+static inline uint32_t block_size(const Block* b){ return b->size & BLOCK_SIZE_MASK; }
+static inline bool block_is_free(const Block* b){ return b->size & BLOCK_FREE; }
+static inline void* block_payload(Block* b){ return (uint8_t*)b + HEADER_SIZE; }
+static inline Block* payload_block(void* p){ return (Block*)((uint8_t*)p - HEADER_SIZE); }
+static inline Block* block_next(Block* b){ return (Block*)((uint8_t*)block_payload(b) + block_size(b)); }
+static inline int fls32(uint32_t x){ return 31 - __builtin_clz(x); }
+static inline int ffs32(uint32_t x){ return __builtin_ctz(x); }
+
+// Free list that holds blocks of exactly this size
+static void mapping_insert(uint32_t size, int* fl, int* sl){
+  if(size < SMALL_BLOCK){
+    *fl = 0;
+    *sl = size / (SMALL_BLOCK / SL_COUNT);
+  }
+  else{
+    int f = fls32(size);
+    *sl = (size >> (f - SL_LOG2)) ^ SL_COUNT;
+    *fl = f - FL_SHIFT + 1;
+  }
+}
+
+// Smallest free list whose blocks are all large enough for this size
+static void mapping_search(uint32_t size, int* fl, int* sl){
+  if(size >= SMALL_BLOCK) size += (1U << (fls32(size) - SL_LOG2)) - 1;
+  mapping_insert(size, fl, sl);
+}
+
+static void list_remove(Block* b){
+  int fl, sl;
+  mapping_insert(block_size(b), &fl, &sl);
+  if(b->prevFree) b->prevFree->nextFree = b->nextFree;
+  else freeLists[fl][sl] = b->nextFree;
+  if(b->nextFree) b->nextFree->prevFree = b->prevFree;
+  if(!freeLists[fl][sl]){
+    slBitmap[fl] &= ~(1U << sl);
+    if(!slBitmap[fl]) flBitmap &= ~(1U << fl);
+  }
+}
+
+static void list_insert(Block* b){
+  int fl, sl;
+  mapping_insert(block_size(b), &fl, &sl);
+  b->size |= BLOCK_FREE;
+  b->prevFree = NULL;
+  b->nextFree = freeLists[fl][sl];
+  if(b->nextFree) b->nextFree->prevFree = b;
+  freeLists[fl][sl] = b;
+  slBitmap[fl] |= 1U << sl;
+  flBitmap |= 1U << fl;
+}
+
+static Block* find_free(uint32_t size){
+  int fl, sl;
+  mapping_search(size, &fl, &sl);
+  if(fl >= FL_COUNT) return NULL;
+  uint32_t slMap = slBitmap[fl] & (~0U << sl);
+  if(!slMap){
+    uint32_t flMap = flBitmap & (~0U << (fl + 1));
+    if(!flMap) return NULL;
+    fl = ffs32(flMap);
+    slMap = slBitmap[fl];
+  }
+  return freeLists[fl][ffs32(slMap)];
+}
+
+// One free block over the whole pool, closed by a used zero-size block that stops coalescing
+static void pool_init(){
+  Block* first = (Block*)pool;
+  Block* last = (Block*)(pool + LVGL_HEAP_SIZE - HEADER_SIZE);
+  first->prevPhys = NULL;
+  first->size = LVGL_HEAP_SIZE - 2 * HEADER_SIZE;
+  last->prevPhys = first;
+  last->size = 0;
+  list_insert(first);
+  poolReady = true;
+}
+
+static uint32_t adjust_size(size_t size){
+  if(size < MIN_PAYLOAD) size = MIN_PAYLOAD;
+  return (size + ALIGN_SIZE - 1) & ~(uint32_t)(ALIGN_SIZE - 1);
+}
+
+static void* pool_alloc(size_t request){
+  if(!poolReady) pool_init();
+  if(request == 0 || request > LVGL_HEAP_SIZE) return NULL;
+
+  uint32_t size = adjust_size(request);
+  Block* b = find_free(size);
+  if(!b) return NULL;
+  list_remove(b);
+
+  // Split off the remainder if it can hold a block of its own
+  uint32_t available = block_size(b);
+  if(available >= size + HEADER_SIZE + MIN_PAYLOAD){
+    Block* rest = (Block*)((uint8_t*)block_payload(b) + size);
+    rest->prevPhys = b;
+    rest->size = available - size - HEADER_SIZE;
+    block_next(rest)->prevPhys = rest;
+    list_insert(rest);
+    b->size = size;
+  }
+  else{
+    b->size = available;
+  }
+  count_alloc(block_size(b));
+  return block_payload(b);
+}
+
+static void pool_free(void* ptr){
+  Block* b = payload_block(ptr);
+  count_free(block_size(b));
+  b->size &= BLOCK_SIZE_MASK;
+
+  Block* prev = b->prevPhys;
+  if(prev && block_is_free(prev)){
+    list_remove(prev);
+    prev->size = (block_size(prev) + HEADER_SIZE + block_size(b));
+    b = prev;
+    block_next(b)->prevPhys = b;
+  }
+  Block* next = block_next(b);
+  if(block_is_free(next)){
+    list_remove(next);
+    b->size = (block_size(b) + HEADER_SIZE + block_size(next));
+    block_next(b)->prevPhys = b;
+  }
+  list_insert(b);
+}
+
+static void* pool_realloc(void* ptr, size_t request){
+  Block* b = payload_block(ptr);
+  uint32_t oldSize = block_size(b);
+  if(adjust_size(request) <= oldSize) return ptr;
+
+  void* fresh = pool_alloc(request);
+  if(!fresh) return NULL;
+  memcpy(fresh, ptr, oldSize);
+  pool_free(ptr);
+  stats.allocs--; // the pair above counts as one allocation
+  stats.frees--;
+  return fresh;
+}
+
+static void pool_walk(lvgl_heap_stats_t* s){
+  s->free_total = 0;
+  s->free_biggest = 0;
+  if(!poolReady) pool_init();
+  for(Block* b = (Block*)pool; block_size(b) != 0; b = block_next(b)){
+    if(!block_is_free(b)) continue;
+    s->free_total += block_size(b);
+    if(block_size(b) > s->free_biggest) s->free_biggest = block_size(b);
+  }
+  s->frag_pct = s->free_total ? 100 - (uint64_t)s->free_biggest * 100 / s->free_total : 0;
+}
+
+#else // LVGL_HEAP_TLSF
+
+// Allocations are prefixed with their size so that frees can be accounted for
+#define HEADER_SIZE 8
+
+static void* pool_alloc(size_t request){
+  if(request == 0) return NULL;
+  uint8_t* p = (uint8_t*)malloc(request + HEADER_SIZE);
+  if(!p) return NULL;
+  *(uint32_t*)p = request;
+  count_alloc(request);
+  return p + HEADER_SIZE;
+}
+
+static void pool_free(void* ptr){
+  uint8_t* p = (uint8_t*)ptr - HEADER_SIZE;
+  count_free(*(uint32_t*)p);
+  free(p);
+}
+
+static void* pool_realloc(void* ptr, size_t request){
+  uint8_t* p = (uint8_t*)ptr - HEADER_SIZE;
+  uint32_t oldSize = *(uint32_t*)p;
+  p = (uint8_t*)realloc(p, request + HEADER_SIZE);
+  if(!p) return NULL;
+  *(uint32_t*)p = request;
+  stats.used = stats.used - oldSize + request;
+  if(stats.used > stats.peak) stats.peak = stats.used;
+  return p + HEADER_SIZE;
+}
+
+static void pool_walk(lvgl_heap_stats_t* s){
+  s->free_total = 0;
+  s->free_biggest = 0;
+  s->frag_pct = 0;
+}
+
+#endif // LVGL_HEAP_TLSF
+
+void* lvgl_heap_alloc(size_t size){
+  void* p = pool_alloc(size);
+  if(!p) stats.failed++;
+  return p;
+}
+
+void lvgl_heap_free(void* ptr){
+  if(ptr) pool_free(ptr);
+}
+
+void* lvgl_heap_realloc(void* ptr, size_t size){
+  if(!ptr) return lvgl_heap_alloc(size);
+  if(size == 0){
+    lvgl_heap_free(ptr);
+    return NULL;
+  }
+  void* p = pool_realloc(ptr, size);
+  if(!p) stats.failed++;
+  return p;
+}
+
+void lvgl_heap_get_stats(lvgl_heap_stats_t* s){
+  *s = stats;
+  pool_walk(s);
+}
+
+// Object count and instance bytes per widget class
+struct ClassCount {
+  const lv_obj_class_t* cls;
+  const char* name;
+  uint32_t count;
+  uint32_t bytes;
+};
+
+static uint32_t instance_size(const lv_obj_class_t* cls){
+  while(cls && cls->instance_size == 0) cls = cls->base_class;
+  return cls ? cls->instance_size : 0;
+}
+
+static void count_objects(lv_obj_t* obj, ClassCount* counts, int n){
+  const lv_obj_class_t* cls = lv_obj_get_class(obj);
+  int i = 0;
+  while(i < n - 1 && counts[i].cls != cls) i++; // last entry collects unknown classes
+  counts[i].count++;
+  counts[i].bytes += instance_size(cls);
+  for(uint32_t c = 0; c < lv_obj_get_child_cnt(obj); c++){
+    count_objects(lv_obj_get_child(obj, c), counts, n);
+  }
+}
+
+void lvgl_heap_report(void){
+  lvgl_heap_stats_t s;
+  lvgl_heap_get_stats(&s);
+
+  Serial.printf("[heap] used %lu B, peak %lu B, %lu blocks, %lu allocs, %lu frees, %lu failed\n",
+                s.used, s.peak, s.blocks, s.allocs, s.frees, s.failed);
+  #if LVGL_HEAP_TLSF
+  Serial.printf("[heap] pool %u B, free %lu B, biggest %lu B, fragmentation %u%%\n",
+                LVGL_HEAP_SIZE, s.free_total, s.free_biggest, s.frag_pct);
+  #endif
+  Serial.print("[heap] sizes");
+  for(int i = 0; i < LVGL_HEAP_SIZE_BINS; i++){
+    if(i < LVGL_HEAP_SIZE_BINS - 1) Serial.printf(" <=%u:%lu", 16U << i, s.size_bins[i]);
+    else Serial.printf(" >%u:%lu", 16U << (i - 1), s.size_bins[i]);
+  }
+  Serial.println();
+
+  ClassCount counts[] = {
+    {&lv_obj_class, "obj", 0, 0},
+    {&lv_label_class, "label", 0, 0},
+    {&lv_btn_class, "btn", 0, 0},
+    {&lv_tabview_class, "tabview", 0, 0},
+    {&lv_btnmatrix_class, "btnmatrix", 0, 0},
+    {NULL, "other", 0, 0},
+  };
+  const int n = sizeof(counts) / sizeof(counts[0]);
+  count_objects(lv_scr_act(), counts, n);
+  count_objects(lv_layer_top(), counts, n);
+  count_objects(lv_layer_sys(), counts, n);
+  Serial.print("[heap] objects");
+  for(int i = 0; i < n; i++){
+    if(counts[i].count) Serial.printf(" %s:%lu (%lu B)", counts[i].name, counts[i].count, counts[i].bytes);
+  }
+  Serial.println();
+
+  // Peak plus 25% headroom for block headers and fragmentation, rounded up to 1 kB
+  uint32_t suggested = ((s.peak + s.peak / 4) + 1023) & ~1023U;
+  Serial.printf("[heap] suggested LVGL_HEAP_SIZE: %lu B\n", suggested);
+}
@@ -2,50 +2,33 @@
 // 2024 Maximilian Kern
 
 #include <Arduino.h>
-#include <Adafruit_VCNL4040.h>
-#include <Servo.h>
 #include <Adafruit_GFX.h>
 #include <Adafruit_SharpMem.h>
 #include <lvgl.h>
 #include <hardware/rtc.h>
+#include <hardware/watchdog.h>
+#include "sram_layout.h"
+#include "lvgl_heap.h"
+#include "scheduler.h"
+#include "checkpoint.h"
+#include "pins.h"
+#include "hal.h"
+#include "trace.h"
+#include "fault_inject.h"
+#include "sensing.h"
+#include "adc_cal.h"
+#include "boot.h"
+#include "charge.h"
+#ifdef SIMULATION
+#include "charger_sim.h"
+#endif
 
 //#define DEBUGDISPLAY
-
-// Pin assignment -----------------------------------------------------------------------------------------------------------------------
-
-#define SW_A 2 // SW_2
-#define SW_B 0 // SW_1
-#define USER_LED 14 // 25 for Pico
-
-#define LCD_CS 1
-#define LCD_MOSI 3
-#define LCD_SCK 6
-
-#define SDA 4
-#define SCL 5
-#define VCN_INT 7
-
-#define CHG_STAT 8
-#define CHG_TMR 11
-
-#define PWM_SERVO 15
-
-#define HBR_AH 9
-#define HBR_AL 10
-#define HBR_BL 12
-#define HBR_BH 13
-
-#define ADC_BAT_A A0
-#define ADC_BAT_B A1
-#define ADC_TEMP_BAT A3
-
-// H-bridge declarations
-enum HBR_STATE {OFF, A_POS, B_POS};
-int hbrdge_currentState = OFF;
-
-// Proximity Sensor declaration
-Adafruit_VCNL4040 vcnl4040 = Adafruit_VCNL4040();
-const int proxThreshold = 75; // detectipon threshold for detecting battery in input chute
+//#define SRAM_BENCH // print render/flush timings over Serial to compare SRAM layouts
+//#define HEAP_MONITOR // print LVGL heap usage, fragmentation and object counts over Serial
+//#define TASK_MONITOR // print run time, latency and overruns of every task over Serial
+//#define CHARGE_STATS // print cells per hour and charger reset times over Serial
+//#define ADC_STATS // print oversampling ratio, resolution and noise of every ADC channel over Serial
 
 // LCD declarations
 Adafruit_SharpMem display(LCD_SCK, LCD_MOSI, LCD_CS, 400, 240, 8000000);
@@ -54,10 +37,13 @@ Adafruit_SharpMem display(LCD_SCK, LCD_MOSI, LCD_CS, 400, 240, 8000000);
 #define BLACK 0
 #define WHITE 1
 
+// LCD framebuffer, statically placed instead of malloc'ed by display.begin()
+SRAM_FRAME_BUF static uint8_t frameBuf[ screenWidth * screenHeight / 8 ];
+
 // LVGL declarations
 static lv_disp_draw_buf_t draw_buf;
-static lv_color_t bufA[ screenWidth * screenHeight / 4 ];
-static lv_color_t bufB[ screenWidth * screenHeight / 4 ];
+SRAM_DRAW_BUF static lv_color_t bufA[ screenWidth * screenHeight / 4 ];
+SRAM_DRAW_BUF static lv_color_t bufB[ screenWidth * screenHeight / 4 ];
 lv_obj_t* objBattPercentage;
 lv_obj_t* objBattIcon;
 lv_obj_t* panel;
@@ -69,22 +55,7 @@ lv_obj_t * infoLabel;
 lv_obj_t * chargeLabel;
 extern const lv_font_t rubik_140;
 lv_obj_t* tabview;
-lv_obj_t* dayButton;
-lv_obj_t* monthButton;
-lv_obj_t* yearButton;
-lv_obj_t* weekdayButton;
-lv_obj_t* minuteButton;
-lv_obj_t* hourButton;
-lv_obj_t* dayButtonL;
-lv_obj_t* monthButtonL;
-lv_obj_t* yearButtonL;
-lv_obj_t* weekdayButtonL;
-lv_obj_t* minuteButtonL;
-lv_obj_t* hourButtonL;
-lv_obj_t* formatButton;
-lv_obj_t* formatButtonL;
-lv_obj_t* languageButton;
-lv_obj_t* languageButtonL;
+lv_obj_t* settingsTab;
 lv_timer_t * returnTimer = NULL;
 lv_timer_t * hintTimer = NULL;
 bool buttonHintsVisible = true;
@@ -93,11 +64,6 @@ lv_obj_t* ejectHint;
 lv_obj_t* settingsButton;
 lv_obj_t* settingsHint;
 
-Servo servo;
-const int LowerServoLimit = 1176; // Servo position for output chute
-const int ServoContactPos = 1400; // Servo position for charging
-const int UpperServoLimit = 1677; // Servo position for input chute
-int currentServoPos = LowerServoLimit;
 
 datetime_t t = {
 .year = 2024,
@@ -111,6 +77,7 @@ datetime_t t = {
 datetime_t tOld;
 enum LANGUAGE {ENGLISH, GERMAN};
 LANGUAGE language_order[] = { ENGLISH, GERMAN };
+const int LANGUAGE_COUNT = sizeof(language_order) / sizeof(language_order[0]);
 int language = language_order[0];
 const char* weekdays_GERMAN[7] = {"Sonntag", "Montag", "Dienstag", "Mittwoch", "Donnerstag", "Freitag", "Samstag"};
 const char* months_GERMAN[13] = {"", "Januar", "Februar", "März", "April", "Mai", "Juni", "Juli", "August", "September", "Oktober", "November", "Dezember"};
@@ -148,14 +115,46 @@ char const * get_month_name(int day){
   return "";
 }
 
-void cycle_language() {
-  language = (language + 1) % (sizeof(language_order) / sizeof(language_order[0]));
+// Show an event on the labels, core 0 only
+void ui_handle_event(const ChargeEvent& event){
+  const char* symbols[] = {LV_SYMBOL_BATTERY_1, LV_SYMBOL_BATTERY_2, LV_SYMBOL_BATTERY_3, LV_SYMBOL_BATTERY_FULL};
+  const char* faults[] = {"No cell contact!", "Bad cell voltage!", "Temperature fault!", "Timeout!",
+                          "Cell refused by charger!", "Shorted cell!", "Dead cell!", "Alkaline or worn cell!",
+                          "Charger status stuck!", "Cell heating up!"};
+  static_assert(sizeof(faults) / sizeof(faults[0]) == FAULT_REASON_COUNT, "one text per FAULT_REASON");
+  static int symbol = 0;
+  static bool faultShown = false; // keep the reason visible until the next cell arrives
+
+  switch(event.type){
+    case EVT_CELL_DETECTED:
+      faultShown = false;
+      lv_label_set_text_static(infoLabel, "Cell detected");
+      break;
+    case EVT_LOADING:
+      lv_label_set_text_static(infoLabel, "Loading Cell...");
+      break;
+    case EVT_CHECKING:
+      lv_label_set_text_static(infoLabel, "Checking Cell...");
+      break;
+    case EVT_CHARGE_PROGRESS: // the battery symbol advances with every progress event
+      lv_label_set_text_static(infoLabel, "");
+      symbol = (symbol + 1) % 4;
+      lv_label_set_text_fmt(chargeLabel, "%.2fV  %s", abs(event.batteryMv) / 1000.0, symbols[symbol]);
+      break;
+    case EVT_EJECTING:
+      lv_label_set_text_static(chargeLabel, "");
+      if(!faultShown) lv_label_set_text_static(infoLabel, "Ejecting Cell...");
+      break;
+    case EVT_FAULT:
+      faultShown = true;
+      lv_label_set_text_static(infoLabel, faults[event.fault < FAULT_REASON_COUNT ? event.fault : 0]);
+      break;
+    case EVT_IDLE:
+      if(!faultShown) lv_label_set_text_static(infoLabel, "");
+      break;
+  }
 }
 
-// State machine declarations
-enum FSM_STATE {WAKEUP, IDLE, FEED, CONTACT, CHARGE, ENDCHARGE};
-int fsm_currentState = IDLE;
-
 void draw_clock(datetime_t t) {
   if(!hourFormat24 && t.hour > 12) lv_label_set_text_fmt(timeLabel, "%d:%02d", t.hour-12, t.min);
   else lv_label_set_text_fmt(timeLabel, "%d:%02d", t.hour, t.min);
@@ -165,10 +164,40 @@ void draw_date(datetime_t) {
   lv_label_set_text_fmt(dateLabel, "%s, %d. %s", get_weekday_name(t.dotw), t.day, get_month_name(t.month));
 }
 
+#ifdef SRAM_BENCH
+// Timing statistics of one stage of the render pipeline
+struct BenchStat {
+  uint32_t sum;
+  uint32_t max;
+  uint32_t count;
+};
+BenchStat benchRender, benchConvert, benchSPI;
+
+void bench_add(BenchStat &stat, uint32_t us){
+  stat.sum += us;
+  stat.count++;
+  if(us > stat.max) stat.max = us;
+}
+
+// Print average/maximum of every stage and start a new measurement window
+void bench_report(){
+  BenchStat* stats[] = {&benchRender, &benchConvert, &benchSPI};
+  const char* names[] = {"render", "convert", "spi"};
+  Serial.printf("[sram] layout %d:", SRAM_LAYOUT);
+  for(int i = 0; i < 3; i++){
+    uint32_t avg = stats[i]->count ? stats[i]->sum / stats[i]->count : 0;
+    Serial.printf("  %s %lu/%lu us", names[i], avg, stats[i]->max);
+    *stats[i] = {0, 0, 0};
+  }
+  Serial.println();
+}
+#endif
+
 // Display flushing
-void my_disp_flush( lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t *color_p ){
-  uint32_t w = ( area->x2 - area->x1 + 1 );
-  uint32_t h = ( area->y2 - area->y1 + 1 );
+SRAM_FAST_CODE void my_disp_flush( lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t *color_p ){
+  #ifdef SRAM_BENCH
+  uint32_t start = micros();
+  #endif
 
   int32_t x, y;
     //Lots of room for optimization here
@@ -178,10 +207,20 @@ void my_disp_flush( lv_disp_drv_t *disp, const lv_area_t *area, lv_color_t *colo
             color_p++;
         }
     }
+  #ifdef SRAM_BENCH
+  uint32_t converted = micros();
+  bench_add(benchConvert, converted - start);
+  #endif
   display.refresh();
+  #ifdef SRAM_BENCH
+  bench_add(benchSPI, micros() - converted);
+  #endif
   lv_disp_flush_ready(disp);
 }
 
+void settings_refresh();
+void settings_focus_first();
+
 // Timer for returning from settings menu to clock screen
 static void returnTimer_callback(lv_timer_t * timer)
 {
@@ -202,6 +241,7 @@ static void hintTimer_callback(lv_timer_t * timer)
 static void keypad_read(lv_indev_drv_t * indev_drv, lv_indev_data_t * data)
 {
   static uint32_t last_key = 0;    
+  static bool waitForRelease = false; // the press that showed the hints must not trigger an action
 
   /*Get the pressed key*/
   uint32_t key = 0;
@@ -211,18 +251,20 @@ static void keypad_read(lv_indev_drv_t * indev_drv, lv_indev_data_t * data)
     else if(!digitalRead(SW_B)) key = LV_KEY_ENTER;
 
   }
+  else if(waitForRelease){
+    if(digitalRead(SW_A) && digitalRead(SW_B)) waitForRelease = false;
+  }
   else{
     if(buttonHintsVisible == true){
-      if(!digitalRead(SW_A)) fsm_currentState = ENDCHARGE;
+      if(!digitalRead(SW_A)){ // Eject, one command per press
+        commandQueue.push(CMD_EJECT);
+        waitForRelease = true;
+      }
       else if(!digitalRead(SW_B)){ // Enter Settings
         lv_tabview_set_act(tabview, 1, LV_ANIM_OFF);
-        lv_group_focus_obj(dayButton);
+        settings_focus_first();
         // Update button labels with initial RTC date and time
-        lv_label_set_text_fmt(dayButtonL, "%02d.", t.day);
-        lv_label_set_text_fmt(monthButtonL, "%02d.", t.month);
-        lv_label_set_text_fmt(yearButtonL, "%04d", t.year);
-        lv_label_set_text_fmt(hourButtonL, "%02d:", t.hour);
-        lv_label_set_text_fmt(minuteButtonL, "%02d", t.min);
+        settings_refresh();
         // start timer to automatically return to tab1
         lv_timer_ready(returnTimer);
         lv_timer_reset(returnTimer);
@@ -237,7 +279,7 @@ static void keypad_read(lv_indev_drv_t * indev_drv, lv_indev_data_t * data)
         lv_obj_clear_flag(settingsHint, LV_OBJ_FLAG_HIDDEN);
         lv_timer_ready(hintTimer);
         lv_timer_reset(hintTimer);
-        delay(100);
+        waitForRelease = true;
       }
     }
   }
@@ -263,271 +305,337 @@ static void return_button_event_cb(lv_event_t * e)
     }
 }
 
-static void day_button_event_cb(lv_event_t * e)
-{
-    if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        t.day = (t.day % 31) + 1; // Cycle through days 1-31
-        rtc_set_datetime(&t);
-        lv_label_set_text_fmt(dayButtonL, "%02d.", t.day);
-    }
-}
+// Settings menu ------------------------------------------------------------------------------------------------------------------------
+
+// One button of the settings tab. Clicking it advances the value by one and wraps from max back to min.
+struct SettingField {
+  const char* rowLabel;           // label in front of the row, NULL for further fields in the same row
+  lv_coord_t x, y, width;
+  int min, max;
+  int (*get)();
+  void (*set)(int value);
+  const char* format;             // printf format of the value, or
+  const char* (*name)(int value); // text for the value
+  bool clock;                     // sets the RTC, checkpointed so the new time survives a power failure
+};
 
-static void month_button_event_cb(lv_event_t * e)
-{
-    if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        t.month = (t.month % 12) + 1; // Cycle through months 1-12
-        rtc_set_datetime(&t);
-        lv_label_set_text_fmt(monthButtonL, "%02d.", t.month);
-    }
-}
+static constexpr SettingField settingFields[] = {
+  // row label  x    y    w    min   max                 getter                           setter                                           format   name                                    clock
+  {"Date:",     50,  44,  40,  1,    31,                 []{ return (int)t.day; },        [](int v){ t.day = v; rtc_set_datetime(&t); },   "%02d.", NULL,                                   true},
+  {NULL,        94,  44,  40,  1,    12,                 []{ return (int)t.month; },      [](int v){ t.month = v; rtc_set_datetime(&t); }, "%02d.", NULL,                                   true},
+  {NULL,        138, 44,  60,  2024, 2034,               []{ return (int)t.year; },       [](int v){ t.year = v; rtc_set_datetime(&t); },  "%04d",  NULL,                                   true},
+  {NULL,        202, 44,  104, 0,    6,                  []{ return (int)t.dotw; },       [](int v){ t.dotw = v; rtc_set_datetime(&t); },  NULL,    get_weekday_name,                       true},
+  {"Time:",     50,  78,  40,  0,    23,                 []{ return (int)t.hour; },       [](int v){ t.hour = v; rtc_set_datetime(&t); },  "%02d:", NULL,                                   true},
+  {NULL,        94,  78,  36,  0,    59,                 []{ return (int)t.min; },        [](int v){ t.min = v; rtc_set_datetime(&t); },   "%02d",  NULL,                                   true},
+  {"Format:",   70,  112, 50,  0,    1,                  []{ return (int)hourFormat24; }, [](int v){ hourFormat24 = v; },                  NULL,    [](int v){ return v ? "24h" : "12h"; }, false},
+  {"Language:", 94,  146, 90,  0,    LANGUAGE_COUNT - 1, []{ return language; },          [](int v){ language = v; draw_date(t); },        NULL,    get_language_name,                      false},
+};
+static constexpr int settingFieldCount = sizeof(settingFields) / sizeof(settingFields[0]);
 
-static void year_button_event_cb(lv_event_t * e)
-{
-    if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        t.year = (t.year < 2034) ? t.year + 1 : 2024; // Cycle through years 2024-2034
-        rtc_set_datetime(&t);
-        lv_obj_t * btn = lv_event_get_target(e);
-        lv_obj_t * label = lv_obj_get_child(btn, 0);
-        lv_label_set_text_fmt(label, "%04d", t.year);
-    }
+constexpr bool settings_table_valid(){
+  for(const SettingField& f : settingFields){
+    if(!f.get || !f.set || f.min > f.max || !f.format == !f.name) return false;
+  }
+  return settingFields[0].rowLabel != NULL;
 }
+static_assert(settings_table_valid(), "settings field needs getter, setter, a valid range and exactly one of format/name");
 
-static void weekday_button_event_cb(lv_event_t * e)
-{
-    if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        t.dotw = (t.dotw + 1) % 7;
-        rtc_set_datetime(&t);
-        lv_obj_t * btn = lv_event_get_target(e);
-        lv_obj_t * label = lv_obj_get_child(btn, 0);
-        lv_label_set_text(label, get_weekday_name(t.dotw));
-    }
+lv_obj_t* settingLabels[settingFieldCount]; // value label inside each field button
+
+// Show the current value of every field
+void settings_refresh(){
+  for(int i = 0; i < settingFieldCount; i++){
+    const SettingField& f = settingFields[i];
+    if(f.name) lv_label_set_text_static(settingLabels[i], f.name(f.get()));
+    else lv_label_set_text_fmt(settingLabels[i], f.format, f.get());
+  }
 }
 
-static void hour_button_event_cb(lv_event_t * e)
-{
-    if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        t.hour = (t.hour + 1) % 24; // Cycle through hours 0-23
-        rtc_set_datetime(&t);
-        lv_label_set_text_fmt(hourButtonL, "%02d:", t.hour);
-    }
+void settings_focus_first(){
+  lv_group_focus_obj(lv_obj_get_parent(settingLabels[0]));
 }
 
-static void minute_button_event_cb(lv_event_t * e)
+// Shared click handler, the event user data points at the field descriptor
+static void settings_event_cb(lv_event_t * e)
 {
     if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        t.min = (t.min + 1) % 60; // Cycle through minutes 0-59
-        rtc_set_datetime(&t);
-        lv_label_set_text_fmt(minuteButtonL, "%02d", t.min);
+        const SettingField* f = (const SettingField*)lv_event_get_user_data(e);
+        int value = f->get();
+        f->set((value >= f->max || value < f->min) ? f->min : value + 1);
+        if(f->clock) commandQueue.push(CMD_CHECKPOINT); // keep the new clock across a power failure
+        settings_refresh(); // other fields may depend on it, e.g. weekday names on the language
     }
 }
 
-static void format_button_event_cb(lv_event_t * e)
-{
-    if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        hourFormat24 = !hourFormat24;
-        if(hourFormat24) lv_label_set_text_fmt(formatButtonL, "24h");
-        else lv_label_set_text_fmt(formatButtonL, "12h");
-        //Serial.println(hourFormat24);
+// Create the row labels and field buttons of the settings tab
+void settings_build(lv_obj_t* tab){
+  for(int i = 0; i < settingFieldCount; i++){
+    const SettingField& f = settingFields[i];
+
+    if(f.rowLabel){
+      lv_obj_t* rowLabel = lv_label_create(tab);
+      lv_label_set_text_static(rowLabel, f.rowLabel);
+      lv_obj_set_style_text_color(rowLabel, lv_color_white(), LV_PART_MAIN);
+      lv_obj_set_style_text_font(rowLabel, &lv_font_montserrat_16, LV_PART_MAIN);
+      lv_obj_align(rowLabel, LV_ALIGN_TOP_LEFT, 0, f.y + 6);
     }
+
+    lv_obj_t* button = lv_btn_create(tab);
+    settingLabels[i] = lv_label_create(button);
+    lv_obj_align(button, LV_ALIGN_TOP_LEFT, f.x, f.y);
+    lv_obj_set_size(button, f.width, 30);
+    lv_obj_set_style_bg_color(button, lv_color_black(), LV_PART_MAIN);
+    lv_obj_set_style_text_font(settingLabels[i], &lv_font_montserrat_16, LV_PART_MAIN);
+    lv_obj_align(settingLabels[i], LV_ALIGN_CENTER, 0, 0);
+    lv_obj_set_style_outline_color(button, lv_color_white(), LV_STATE_FOCUS_KEY);
+    lv_obj_set_style_outline_opa(button, 255, LV_STATE_FOCUS_KEY);
+    lv_obj_add_event_cb(button, settings_event_cb, LV_EVENT_CLICKED, (void*)&f);
+  }
+  settings_refresh();
 }
 
-static void language_button_event_cb(lv_event_t * e)
-{
-    if(lv_event_get_code(e) == LV_EVENT_CLICKED) {
-        cycle_language();
-        lv_label_set_text_fmt(languageButtonL, get_language_name(language));
-        rtc_get_datetime(&t);
-        draw_date(t);
-        lv_label_set_text(weekdayButtonL, get_weekday_name(t.dotw));
-    }
+// Boot report ----------------------------------------------------------------------------------------------------------------------------
+// The phases of both cores are timed in boot.cpp, see boot.h.
+
+#define BOOT_CLOCK_BUDGET_MS 300 // target time from reset to the first clock frame
+
+uint32_t bootFirstFrameMs = 0;
+bool bootReported = false;
+
+void watchdog_report();
+
+void boot_report(){
+  watchdog_report();
+  boot_phases_report();
+  Serial.printf("[boot] clock shown after %lu ms, budget %d ms%s\n", bootFirstFrameMs, BOOT_CLOCK_BUDGET_MS,
+                bootFirstFrameMs > BOOT_CLOCK_BUDGET_MS ? " - over budget" : "");
 }
 
-float getVBat(){
-  float sum = 0;
-  for (int i = 0; i < 16; i++) {
-    sum += 0.001 * 2 * (0.806 * analogRead(A1) - 0.806 * analogRead(A0));
+// USB serial is usually not connected yet when booting completes, print once the host opens the port
+void boot_report_poll(){
+  if(!bootReported && boot_complete(0) && boot_complete(1) && Serial){
+    bootReported = true;
+    boot_report();
   }
-  return sum / 16;   
 }
 
-// Set the H-bridge state
-void h_bridge_set(int hbrState){
-  switch (hbrState){
-    case A_POS: // Terminal A positive and Terminal B negative
-      digitalWrite(HBR_AL, LOW);
-      digitalWrite(HBR_AH, HIGH);
-      digitalWrite(HBR_BL, HIGH);
-      digitalWrite(HBR_BH, LOW);
-      break;
-    case B_POS: // Terminal B positive and Terminal A negative
-      digitalWrite(HBR_AL, HIGH);
-      digitalWrite(HBR_AH, LOW);
-      digitalWrite(HBR_BL, LOW);
-      digitalWrite(HBR_BH, HIGH);
-      break;
-    case OFF: // All MOSFETs off
-    default:
-      digitalWrite(HBR_AL, LOW);
-      digitalWrite(HBR_AH, LOW);
-      digitalWrite(HBR_BL, LOW);
-      digitalWrite(HBR_BH, LOW);
-  }  
-}
-
-// Source: http://www.scynd.de/tutorials/arduino-tutorials/5-sensoren/5-1-temperatur-mit-10k%CF%89-ntc.html
-float NTCTemp(pin_size_t ADC_pin, int n_measurements){
-
-  const int ntcNominal = 10000;         // Wiederstand des NTC bei Nominaltemperatur
-  const int tempNominal = 25;           // Temperatur bei der der NTC den angegebenen Wiederstand hat
-  const int bCoefficient = 3380;        // Beta Coefficient(B25 aus Datenblatt des NTC)
-
-  int series_resistor = 10000;
-
-  int measurements = 0;
-  for (int i=0; i < n_measurements; i++)
-  {
-    measurements += analogRead(ADC_pin);
-    delay(10);
-  }   
-  float average = measurements /= n_measurements;
-   
-  // Convert the ADC value to a resistance
-  average = 4096 / average - 1;
-  average = series_resistor / average;
-   
-  // Umrechnung aller Ergebnisse in die Temperatur mittels einer Steinhard Berechnung
-  float temp = average / ntcNominal;     // (R/Ro)
-  temp = log(temp);                     // ln(R/Ro)
-  temp /= bCoefficient;                 // 1/B * ln(R/Ro)
-  temp += 1.0 / (tempNominal + 273.15); // + (1/To)
-  temp = 1.0 / temp;                    // Invertieren
-  temp -= 273.15;                       // Umwandeln in °C
-
-  return temp;
-}
-
-void fsm_idle(){ 
-  // keep the servo in the lowest position
-  while(currentServoPos != LowerServoLimit){      
-    if(currentServoPos < LowerServoLimit) servo.writeMicroseconds(currentServoPos++);
-    if(currentServoPos > LowerServoLimit) servo.writeMicroseconds(currentServoPos--);
-    delay(3);
-  } 
-  // Check if a battery is in the feeder chute
-  if(vcnl4040.getProximity() > proxThreshold ){
-    //battery detected!
-    fsm_currentState = FEED;    
-  }
+// Tasks --------------------------------------------------------------------------------------------------------------------------------
+
+// Blink debug LED at 1 Hz
+void task_led(){
+  digitalWrite(USER_LED, millis() % 1000 > 500);
 }
 
-void fsm_feed(){
-  // move the feeder arm up
-  while(currentServoPos < UpperServoLimit){      
-    servo.writeMicroseconds(currentServoPos++);
-    delay(3);
+// Update the clock display
+void task_clock(){
+  rtc_get_datetime(&t);
+  if(tOld.min != t.min || tOld.hour != t.hour){ // avoid updating the time label too often (increases FPS)
+    draw_clock(t);
   }
-  // Show status
-  lv_label_set_text_fmt(infoLabel, "Loading Cell...");  
+  if(tOld.day != t.day || tOld.month != t.month || tOld.dotw != t.dotw){ // avoid updating the date label too often (increases FPS)
+    draw_date(t);
+  }
+  tOld = t;
+}
+
+// Update LVGL UI
+void task_ui(){
+  // Events from the charge core, rendered below in one place
+  ChargeEvent event;
+  while(eventBus.pop(event)) ui_handle_event(event);
+
+  #ifdef SRAM_BENCH
+  uint32_t renderStart = micros();
+  lv_timer_handler();
+  bench_add(benchRender, micros() - renderStart);
+  #else
   lv_timer_handler();
-  // wait for the battery to drop into the feeder arm 
-  delay(1000);
-  fsm_currentState = CONTACT;
+  #endif
 }
 
-void fsm_contact(){
+void task_report();
+#ifdef FAULT_INJECTION
+void task_fault(){
+  fault_poll(faultScenarios, FAULT_SCENARIO_COUNT);
+}
+#endif
+#ifdef ADC_CALIBRATION
+// Flash is written by core 1, like the checkpoints
+void task_calibration(){
+  if(adc_cal_poll()) commandQueue.push(CMD_SAVE_CALIBRATION);
+}
+#endif
+void task_watchdog0();
+void task_watchdog1();
+
+// Core 1: charge path. Table order is priority order.
+Task tasksCore1[] = {
+  //   name         function        period ms  deadline ms
+  TASK("watchdog",  task_watchdog1, 10,        10),
+  #if defined(SIMULATION)
+  TASK("sim",       task_sim,       5,         20),
+  #elif defined(TRACE_REPLAY)
+  TASK("replay",    task_replay,    5,         20),
+  #else
+  TASK("charge",    task_charge,    5,         20),
+  TASK("sensors",   task_sensors,   10,        10),
+  TASK("proximity", task_proximity, 100,       50),
+  #endif
+};
+const int TASK_COUNT_CORE1 = sizeof(tasksCore1) / sizeof(tasksCore1[0]);
+
+// Core 0: user interface
+Task tasksCore0[] = {
+  //   name         function        period ms  deadline ms
+  TASK("watchdog",  task_watchdog0, 10,        10),
+  TASK("led",       task_led,       100,       100),
+  TASK("clock",     task_clock,     250,       250),
+  TASK("ui",        task_ui,        10,        150),
+  TASK("report",    task_report,    5000,      1000),
+  #if defined(TRACE_RECORD) || defined(TRACE_REPLAY)
+  TASK("trace",     trace_poll,     10,        50),
+  #endif
+  #ifdef FAULT_INJECTION
+  TASK("fault",     task_fault,     10,        50),
+  #endif
+  #ifdef ADC_CALIBRATION
+  TASK("cal",       task_calibration, 10,      50),
+  #endif
+};
+const int TASK_COUNT_CORE0 = sizeof(tasksCore0) / sizeof(tasksCore0[0]);
+
+// Watchdog -------------------------------------------------------------------------------------------------------------------------------
+// Each core supervises the task table of the other one. A table whose tasks are further past their release than its hang
+// limit has hung, e.g. in a blocking I2C or SPI transfer. The limit is WATCHDOG_HANG_FACTOR times the longest pass over the
+// table measured since boot, at least WATCHDOG_HANG_MIN_MS: a released task waits at most one pass, so only a task that
+// runs far longer than it ever did counts. A checkpoint written to flash pauses the other core, neither table is
+// supervised during the stall and for one hang limit after it, see checkpoint.h. The supervisor turns the H-bridge off first, lowers the servo, records
+// the reason in the watchdog scratch registers and core 0 stops feeding the hardware watchdog, which then resets the chip.
+// If both cores hang nobody feeds it and the reset (all pins back to inputs) turns the H-bridge off.
+//
+// Worst case from hang to H-bridge off: the hang limit + WATCHDOG_PERIOD_MS + the longest task on the supervising core,
+// or WATCHDOG_TIMEOUT_MS if both cores hang. The measured value is reported after the reset, the limits in use with
+// TASK_MONITOR.
+
+#define WATCHDOG_TIMEOUT_MS 250  // hardware watchdog, reloaded for CHECKPOINT_STALL_MAX_MS around a flash erase
+#define WATCHDOG_HANG_FACTOR 2   // hang limit over the longest measured pass of the table
+#define WATCHDOG_HANG_MIN_MS 100 // lower bound of the hang limit, covers runs not seen since boot yet
+#define WATCHDOG_PERIOD_MS 10    // period of the watchdog tasks, see the task tables
+#define WATCHDOG_HANG_MAX_MS (WATCHDOG_TIMEOUT_MS - 2 * WATCHDOG_PERIOD_MS) // caught before the hardware watchdog fires
+#define WATCHDOG_MAGIC 0x57440000
+static_assert(WATCHDOG_HANG_MIN_MS < WATCHDOG_HANG_MAX_MS, "a hang must be caught before the hardware watchdog fires");
+
+volatile bool watchdogTripped = false;
+bool watchdogEnabled = false;
+uint32_t watchdogRecord[2] = {0, 0}; // scratch registers as the last reset left them
+
+// Safe state, callable from either core
+void watchdog_trip(int core, int task, const Task& hung){
+  h_bridge_set(OFF); // first, nothing else matters as much
+  uint32_t hangToOffMs = (micros() - (hung.busy ? hung.startUs : hung.nextRelease)) / 1000;
   hbrdge_currentState = OFF;
-  h_bridge_set(hbrdge_currentState);
-
-  // move the feeder arm to to the middle
-  while(currentServoPos > ServoContactPos){      
-    servo.writeMicroseconds(currentServoPos--);
-    delay(10);
-  }
-  delay(500);
-  // sanity check - proper battery voltage?
-  if(abs(getVBat()) < 0.2 || abs(getVBat()) > 1.40){
-    fsm_currentState = ENDCHARGE;
-  }
-  // find out the polarity and set the h-bridge accordingly
-  else{
-    if(getVBat() >= 0){
-      hbrdge_currentState = A_POS;
-    }
-    else{
-      hbrdge_currentState = B_POS;
-    }    
-    h_bridge_set(hbrdge_currentState);
-    // turn off servo while charging
-    servo.detach();
-    // wait a moment for the charge IC to check the battery
-    lv_label_set_text_fmt(infoLabel, "Checking Cell...");
-    lv_timer_handler();
-    for(int i = 0; i < 3000; i+=100){
-      
-      delay(100);
-    }    
-    fsm_currentState = CHARGE;
-  }
+  if(watchdogTripped) return;
+  watchdogTripped = true;
+  watchdog_hw->scratch[0] = WATCHDOG_MAGIC | core << 8 | task;
+  watchdog_hw->scratch[1] = hangToOffMs;
+  hal_servo_attach(LowerServoLimit);
 }
 
-void fsm_charge(){
-  boolean chargingOK = true;
+uint32_t watchdog_hang_ms(const Task* tasks, int count){
+  uint32_t limit = WATCHDOG_HANG_FACTOR * scheduler_longest_pass(tasks, count) / 1000;
+  return constrain(limit, (uint32_t)WATCHDOG_HANG_MIN_MS, (uint32_t)WATCHDOG_HANG_MAX_MS);
+}
 
-  // check if temperature is within limits
-  float currentTemperature = NTCTemp(ADC_TEMP_BAT, 5);
-  if(currentTemperature > 60 || currentTemperature < 0){
-    chargingOK = false;
-  }
+void watchdog_check(Task* tasks, int count, int core){
+  uint32_t limit = watchdog_hang_ms(tasks, count);
+  if(checkpoint_flash_stalled(limit)) return;
+  int stuck = scheduler_stuck(tasks, count, limit * 1000);
+  if(stuck >= 0) watchdog_trip(core, stuck, tasks[stuck]);
+}
 
-  lv_label_set_text_fmt(infoLabel, "");
+bool watchdog_both_cores_up(){
+  return boot_complete(0) && boot_complete(1);
+}
 
-  // update status label
-  switch((millis() / 500) % 4){
-    case 0: 
-      lv_label_set_text_fmt(chargeLabel, "%.2fV  %s", abs(getVBat()), LV_SYMBOL_BATTERY_1);
-      break;
-    case 1: 
-      lv_label_set_text_fmt(chargeLabel, "%.2fV  %s", abs(getVBat()), LV_SYMBOL_BATTERY_2);
-      break;
-    case 2: 
-      lv_label_set_text_fmt(chargeLabel, "%.2fV  %s", abs(getVBat()), LV_SYMBOL_BATTERY_3);
-      break;
-    case 3: 
-      lv_label_set_text_fmt(chargeLabel, "%.2fV  %s", abs(getVBat()), LV_SYMBOL_BATTERY_FULL);
-      break;
+// Core 0: supervise core 1 and feed the hardware watchdog
+void task_watchdog0(){
+  if(!watchdog_both_cores_up()) return;
+  if(!watchdogEnabled){
+    watchdog_enable(WATCHDOG_TIMEOUT_MS, true);
+    watchdogEnabled = true;
   }
-  
-  // Detect end of charge or fault condition
-  if(digitalRead(CHG_STAT) == HIGH){
-    fsm_currentState = ENDCHARGE;
-  }  
+  watchdog_check(tasksCore1, TASK_COUNT_CORE1, 1);
+  if(!watchdogTripped) watchdog_update();
 }
 
-void fsm_endcharge(){
-  // update info label
-  lv_label_set_text_fmt(chargeLabel, "");
-  lv_label_set_text_fmt(infoLabel, "Ejecting Cell...");
-  lv_timer_handler();
-  servo.attach(PWM_SERVO);
+// Core 1: supervise core 0
+void task_watchdog1(){
+  if(!watchdog_both_cores_up()) return;
+  watchdog_check(tasksCore0, TASK_COUNT_CORE0, 0);
+}
 
-  hbrdge_currentState = OFF;
-  h_bridge_set(hbrdge_currentState);
+// The scratch registers survive a watchdog reset. Take the record out at boot, before either core can trip, so a later
+// hardware watchdog reset that leaves none is not reported as this hang again.
+void watchdog_take_record(){
+  watchdogRecord[0] = watchdog_hw->scratch[0];
+  watchdogRecord[1] = watchdog_hw->scratch[1];
+  watchdog_hw->scratch[0] = 0;
+  watchdog_hw->scratch[1] = 0;
+}
 
-  // keep the servo in the lowest position
-  while(currentServoPos != LowerServoLimit){      
-    if(currentServoPos < LowerServoLimit) servo.writeMicroseconds(currentServoPos++);
-    if(currentServoPos > LowerServoLimit) servo.writeMicroseconds(currentServoPos--);
-    delay(3);
+// Print why the last reset happened
+void watchdog_report(){
+  uint32_t record = watchdogRecord[0];
+  if(!watchdog_caused_reboot()){
+    Serial.println("[watchdog] power-on or external reset");
   }
-  delay(5000); // give the DS2712 charger some time to reset
-
-  fsm_currentState = IDLE;
+  else if((record & 0xFFFF0000) == WATCHDOG_MAGIC){
+    int core = (record >> 8) & 0xFF;
+    int task = record & 0xFF;
+    const char* name = core == 0 ? (task < TASK_COUNT_CORE0 ? tasksCore0[task].name : "?")
+                                 : (task < TASK_COUNT_CORE1 ? tasksCore1[task].name : "?");
+    Serial.printf("[watchdog] reset after core%d task %s hung, H-bridge off %lu ms after the hang\n", core, name,
+                  watchdogRecord[1]);
+  }
+  else{
+    Serial.printf("[watchdog] reset by the hardware watchdog, H-bridge off within %d ms\n", WATCHDOG_TIMEOUT_MS);
+  }
+}
 
-  lv_label_set_text_fmt(infoLabel, "");
-  lv_timer_handler();
+// Serial diagnostics
+void task_report(){
+  boot_report_poll();
+  #ifdef SRAM_BENCH
+  bench_report();
+  #endif
+  #ifdef SENSE_BENCH
+  sensing_bench();
+  #endif
+  #ifdef HEAP_MONITOR
+  lvgl_heap_report();
+  #endif
+  #ifdef TASK_MONITOR
+  scheduler_report(tasksCore0, TASK_COUNT_CORE0);
+  scheduler_report(tasksCore1, TASK_COUNT_CORE1); // read while core 1 updates them, good enough for diagnostics
+  Serial.printf("[watchdog] hang limit core0 %lu ms, core1 %lu ms\n", watchdog_hang_ms(tasksCore0, TASK_COUNT_CORE0),
+                watchdog_hang_ms(tasksCore1, TASK_COUNT_CORE1));
+  #endif
+  #ifdef CHARGE_STATS
+  charge_stats_report();
+  #endif
+  #ifdef ADC_STATS
+  adc_stats_report();
+  #endif
+  #ifdef SIMULATION
+  sim_report();
+  #endif
 }
 
+void boot_settings_ui();
+
 void setup() {
+  boot_phase("startup");
+  watchdog_take_record();
 
   // --- IO Initialization ---
   pinMode(USER_LED, OUTPUT);
@@ -536,55 +644,24 @@ void setup() {
   pinMode(SW_B, INPUT_PULLUP);
   pinMode(SW_A, INPUT_PULLUP);
 
-  // Proximity Sensor Interrupt
-  pinMode(VCN_INT, INPUT);
-
-  // H-Bridge Controls
-  pinMode(HBR_AL, OUTPUT);
-  pinMode(HBR_AH, OUTPUT);
-  pinMode(HBR_BL, OUTPUT);
-  pinMode(HBR_BH, OUTPUT);
-  pinMode(ADC_BAT_A, INPUT);
-  pinMode(ADC_BAT_B, INPUT);
-  pinMode(ADC_TEMP_BAT, INPUT);
-
-  // Charger
-  pinMode(CHG_STAT, INPUT_PULLUP);
-  pinMode(CHG_TMR, INPUT);
-  
-  // Servo
-  pinMode(PWM_SERVO, OUTPUT);
-
   //LCD
   pinMode(LCD_CS, OUTPUT); // this line is important since the adafruit library was ported to HW SPI!
 
   // Serial Init
   Serial.begin(115200);
-  
-  // Charger Init
-  h_bridge_set(OFF);
 
-  // ADC Init
-  analogReadResolution(12);
-
-  // RTC Init
+  // RTC Init, continue from the last checkpoint if there is one
+  Checkpoint checkpoint;
+  if(checkpoint_load(checkpoint)) checkpoint_datetime(checkpoint.wallClock, t);
   rtc_init();
   rtc_set_datetime(&t);
-
-  // Proximity Sensor Init
-  Wire.begin();
-  vcnl4040.begin();
+  boot_phase("io");
 
   // Display Init
-  display.begin();
+  display.begin(frameBuf);
   display.setRotation(0);
-  display.clearDisplay();
-  display.refresh();
-
-  h_bridge_set(hbrdge_currentState);
-
-  servo.writeMicroseconds(currentServoPos);
-  servo.attach(PWM_SERVO);
+  display.clearDisplay(); // the clear command blanks the panel, a full refresh is not needed
+  boot_phase("display");
 
   // Setup LVGL
   lv_init();
@@ -599,12 +676,7 @@ void setup() {
   disp_drv.draw_buf = &draw_buf;
   lv_disp_drv_register( &disp_drv );
 
-  // Initialize the keyboard driver
-  static lv_indev_drv_t indev_drv;    
-  lv_indev_drv_init(&indev_drv);
-  indev_drv.type = LV_INDEV_TYPE_KEYPAD;
-  indev_drv.read_cb = keypad_read;
-  lv_indev_t *indev = lv_indev_drv_register(&indev_drv);
+  boot_phase("lvgl");
 
   // --- LVGL UI Configuration ---  
   
@@ -618,7 +690,7 @@ void setup() {
 
   // Add tabs to tabview
   lv_obj_t* tab1 = lv_tabview_add_tab(tabview, "Clock");
-  lv_obj_t* tab2 = lv_tabview_add_tab(tabview, "Settings");
+  settingsTab = lv_tabview_add_tab(tabview, "Settings");
 
   // Creat labels for date, time and status
 
@@ -684,148 +756,41 @@ void setup() {
   lv_obj_set_style_text_font(settingsHint, &lv_font_montserrat_16, LV_PART_MAIN);
   lv_obj_align(settingsHint, LV_ALIGN_BOTTOM_RIGHT, -60, -6);
 
-  
-  // --------------------------------------------------------------------------------
-  // Content for tab2
+  // Timer for displaying button hints
+  hintTimer = lv_timer_create(hintTimer_callback, 3000, NULL);
+
+  lv_tabview_set_act(tabview, 0, LV_ANIM_OFF);
+  boot_phase("clock ui");
+
+  // Render the clock right away
+  draw_clock(t);
+  draw_date(t);
+  tOld = t;
+  lv_refr_now(NULL);
+  boot_phase("first frame");
+  bootFirstFrameMs = millis();
+
+  // The clock is visible, now build the settings tab and enable the buttons
+  boot_settings_ui();
+  boot_phase("settings ui");
+  scheduler_start(tasksCore0, TASK_COUNT_CORE0);
+  boot_done();
+}
 
-  lv_obj_t* settingsLabel = lv_label_create(tab2);
+// Content of the settings tab, the keypad input device and its timers
+void boot_settings_ui(){
+  lv_obj_t* settingsLabel = lv_label_create(settingsTab);
   lv_label_set_text(settingsLabel, "Settings");
   lv_obj_set_style_text_color(settingsLabel, lv_color_white(), LV_PART_MAIN);
   lv_obj_set_style_text_font(settingsLabel, &lv_font_montserrat_24, LV_PART_MAIN);
   lv_obj_center(settingsLabel);
   lv_obj_align(settingsLabel, LV_ALIGN_TOP_LEFT, 0, 0);
 
-  // Date Setting
-
-  lv_obj_t* tempLabel = lv_label_create(tab2);
-  lv_label_set_text(tempLabel, "Date:");
-  lv_obj_set_style_text_color(tempLabel, lv_color_white(), LV_PART_MAIN);
-  lv_obj_set_style_text_font(tempLabel, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_center(tempLabel);
-  lv_obj_align(tempLabel, LV_ALIGN_TOP_LEFT, 0, 50);
-
-  dayButton = lv_btn_create(tab2);
-  dayButtonL = lv_label_create(dayButton);
-  lv_obj_align(dayButton, LV_ALIGN_TOP_LEFT, 50, 44);
-  lv_obj_set_size(dayButton, 40, 30);  
-  lv_obj_set_style_bg_color(dayButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(dayButtonL, "26.");
-  lv_obj_set_style_text_font(dayButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(dayButtonL, LV_ALIGN_CENTER, 0, 0);
-  lv_obj_set_style_outline_color(dayButton, lv_color_white(), LV_STATE_FOCUS_KEY);
-  lv_obj_set_style_outline_opa(dayButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(dayButton, day_button_event_cb, LV_EVENT_CLICKED, NULL);
-
-  monthButton = lv_btn_create(tab2);
-  monthButtonL = lv_label_create(monthButton);
-  lv_obj_align(monthButton, LV_ALIGN_TOP_LEFT, 94, 44);
-  lv_obj_set_size(monthButton, 40, 30);
-  lv_obj_set_style_bg_color(monthButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(monthButtonL, "10.");
-  lv_obj_set_style_text_font(monthButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(monthButtonL, LV_ALIGN_CENTER, 0, 0);
-  lv_obj_set_style_outline_color(monthButton, lv_color_white(), LV_STATE_FOCUS_KEY);
-  lv_obj_set_style_outline_opa(monthButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(monthButton, month_button_event_cb, LV_EVENT_CLICKED, NULL);
-
-  yearButton = lv_btn_create(tab2);
-  yearButtonL = lv_label_create(yearButton);
-  lv_obj_align(yearButton, LV_ALIGN_TOP_LEFT, 138, 44);
-  lv_obj_set_size(yearButton, 60, 30);
-  lv_obj_set_style_bg_color(yearButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(yearButtonL, "2024");
-  lv_obj_set_style_text_font(yearButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(yearButtonL, LV_ALIGN_CENTER, 0, 0);
-  lv_obj_set_style_outline_color(yearButton, lv_color_white(), LV_STATE_FOCUS_KEY);
-  lv_obj_set_style_outline_opa(yearButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(yearButton, year_button_event_cb, LV_EVENT_CLICKED, NULL);
-  
-  weekdayButton = lv_btn_create(tab2);
-  weekdayButtonL = lv_label_create(weekdayButton);
-  lv_obj_align(weekdayButton, LV_ALIGN_TOP_LEFT, 202, 44);
-  lv_obj_set_size(weekdayButton, 104, 30);
-  lv_obj_set_style_bg_color(weekdayButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(weekdayButtonL, get_weekday_name(t.dotw));
-  lv_obj_set_style_text_font(weekdayButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(weekdayButtonL, LV_ALIGN_CENTER, 0, 0);  
-  lv_obj_set_style_outline_opa(weekdayButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(weekdayButton, weekday_button_event_cb, LV_EVENT_CLICKED, NULL);
-
-
-  // Time Setting
-
-  tempLabel = lv_label_create(tab2);
-  lv_label_set_text(tempLabel, "Time:");
-  lv_obj_set_style_text_color(tempLabel, lv_color_white(), LV_PART_MAIN);
-  lv_obj_set_style_text_font(tempLabel, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_center(tempLabel);
-  lv_obj_align(tempLabel, LV_ALIGN_TOP_LEFT, 0, 84);
-
-  hourButton = lv_btn_create(tab2);
-  hourButtonL = lv_label_create(hourButton);
-  lv_obj_align(hourButton, LV_ALIGN_TOP_LEFT, 50, 78);
-  lv_obj_set_size(hourButton, 40, 30);
-  lv_obj_set_style_bg_color(hourButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(hourButtonL, "35:");
-  lv_obj_set_style_text_font(hourButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(hourButtonL, LV_ALIGN_CENTER, 0, 0);
-  lv_obj_set_style_outline_opa(hourButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(hourButton, hour_button_event_cb, LV_EVENT_CLICKED, NULL);
-
-  minuteButton = lv_btn_create(tab2);
-  minuteButtonL = lv_label_create(minuteButton);
-  lv_obj_align(minuteButton, LV_ALIGN_TOP_LEFT, 94, 78);
-  lv_obj_set_size(minuteButton, 36, 30);
-  lv_obj_set_style_bg_color(minuteButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(minuteButtonL, "12");
-  lv_obj_set_style_text_font(minuteButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(minuteButtonL, LV_ALIGN_CENTER, 0, 0);
-  lv_obj_set_style_outline_opa(minuteButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(minuteButton, minute_button_event_cb, LV_EVENT_CLICKED, NULL);
-
-  // Hour Format Setting
-
-  tempLabel = lv_label_create(tab2);
-  lv_label_set_text(tempLabel, "Format:");
-  lv_obj_set_style_text_color(tempLabel, lv_color_white(), LV_PART_MAIN);
-  lv_obj_set_style_text_font(tempLabel, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_center(tempLabel);
-  lv_obj_align(tempLabel, LV_ALIGN_TOP_LEFT, 0, 118);
-
-  formatButton = lv_btn_create(tab2);
-  formatButtonL = lv_label_create(formatButton);
-  lv_obj_align(formatButton, LV_ALIGN_TOP_LEFT, 70, 112);
-  lv_obj_set_size(formatButton, 50, 30);
-  lv_obj_set_style_bg_color(formatButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(formatButtonL, "24h");
-  lv_obj_set_style_text_font(formatButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(formatButtonL, LV_ALIGN_CENTER, 0, 0);
-  lv_obj_set_style_outline_opa(formatButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(formatButton, format_button_event_cb, LV_EVENT_CLICKED, NULL);
-
-  // Language Setting
-
-  tempLabel = lv_label_create(tab2);
-  lv_label_set_text(tempLabel, "Language:");
-  lv_obj_set_style_text_color(tempLabel, lv_color_white(), LV_PART_MAIN);
-  lv_obj_set_style_text_font(tempLabel, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_center(tempLabel);
-  lv_obj_align(tempLabel, LV_ALIGN_TOP_LEFT, 0, 152);
-
-  languageButton = lv_btn_create(tab2);
-  languageButtonL = lv_label_create(languageButton);
-  lv_obj_align(languageButton, LV_ALIGN_TOP_LEFT, 94, 146);
-  lv_obj_set_size(languageButton, 90, 30);
-  lv_obj_set_style_bg_color(languageButton, lv_color_black(), LV_PART_MAIN);
-  lv_label_set_text(languageButtonL, get_language_name(language));
-  lv_obj_set_style_text_font(languageButtonL, &lv_font_montserrat_16, LV_PART_MAIN);
-  lv_obj_align(languageButtonL, LV_ALIGN_CENTER, 0, 0);
-  lv_obj_set_style_outline_opa(languageButton, 255, LV_STATE_FOCUS_KEY);
-  lv_obj_add_event_cb(languageButton, language_button_event_cb, LV_EVENT_CLICKED, NULL);
+  settings_build(settingsTab);
 
   // Return Button
 
-  lv_obj_t* returnButton = lv_btn_create(tab2);
+  lv_obj_t* returnButton = lv_btn_create(settingsTab);
   lv_obj_t* returnButtonL = lv_label_create(returnButton);
   lv_obj_align(returnButton, LV_ALIGN_BOTTOM_LEFT, 0, 00);
   lv_obj_set_size(returnButton, 84, 30);
@@ -836,39 +801,34 @@ void setup() {
   lv_obj_set_style_outline_opa(returnButton, 255, LV_STATE_FOCUS_KEY);
   lv_obj_add_event_cb(returnButton, return_button_event_cb, LV_EVENT_CLICKED, NULL);
 
-  lv_gridnav_add(tab2, LV_GRIDNAV_CTRL_ROLLOVER);
+  lv_gridnav_add(settingsTab, LV_GRIDNAV_CTRL_ROLLOVER);
+
+  // Initialize the keyboard driver
+  static lv_indev_drv_t indev_drv;    
+  lv_indev_drv_init(&indev_drv);
+  indev_drv.type = LV_INDEV_TYPE_KEYPAD;
+  indev_drv.read_cb = keypad_read;
+  lv_indev_t *indev = lv_indev_drv_register(&indev_drv);
 
   /* Create a group and add objects to it */ 
   lv_group_t * group = lv_group_create();
-  lv_group_add_obj(group, dayButton);
-  lv_group_add_obj(group, monthButton);
-  lv_group_add_obj(group, yearButton);
-  lv_group_add_obj(group, weekdayButton);
-  lv_group_add_obj(group, hourButton);
-  lv_group_add_obj(group, minuteButton);
-  lv_group_add_obj(group, formatButton);
-  lv_group_add_obj(group, languageButton);
+  for(int i = 0; i < settingFieldCount; i++){
+    lv_group_add_obj(group, lv_obj_get_parent(settingLabels[i]));
+  }
   lv_group_add_obj(group, returnButton);
   /* Assign the input device to the group */
   lv_indev_set_group(indev, group);
   
 
-  lv_group_focus_obj(dayButton);
+  settings_focus_first();
 
   // Timer for returning from settings menu to clock
   returnTimer = lv_timer_create(returnTimer_callback, 10000, NULL);
-  // Timer for displaying button hints
-  hintTimer = lv_timer_create(hintTimer_callback, 3000, NULL);
-
-  lv_tabview_set_act(tabview, 0, LV_ANIM_OFF);  
 }
 
-
 void loop() {
-  // Blink debug LED at 1 Hz
-  digitalWrite(USER_LED, millis() % 1000 > 500);
-  
   #ifdef DEBUGDISPLAY 
+    SensorSnapshot sensors = sensorSnapshot.read();
   
     display.setTextColor(BLACK);
     display.setTextSize(2);
@@ -882,11 +842,13 @@ void loop() {
     if(hbrdge_currentState == B_POS) display.println("A- B+");  
 
     display.print("ADC_TEMP_BAT: ");
-    display.print(NTCTemp(ADC_TEMP_BAT, 5));
-    display.println("C");
+    display.print(sensors.temperature / 100.0);
+    display.print("C ");
+    display.print(sensors.temperatureSlope / 100.0);
+    display.println("C/min");
 
     display.print("V_BAT: ");
-    display.print(getVBat());
+    display.print(sensors.batteryMv / 1000.0);
     display.println("V");
 
     display.print("Buttons pressed:");
@@ -895,12 +857,12 @@ void loop() {
     display.println();
 
     display.print("Charge status: ");
-    if(digitalRead(CHG_STAT)) display.println("complete/disabled");
+    if(sensors.chargerDone) display.println("complete/disabled");
     else display.println("charging");
 
     display.print("Proximity: ");
     display.print("-");
-    display.print(vcnl4040.getProximity());
+    display.print(sensors.proximity);
     display.println();
 
     display.print("Servo Position: ");
@@ -912,41 +874,21 @@ void loop() {
     display.println();
 
   #endif
-  
-  // Update servo position
-  currentServoPos = constrain(currentServoPos, LowerServoLimit, UpperServoLimit);
-  servo.writeMicroseconds(currentServoPos);
-  
-  // Handle the state machine
-  switch(fsm_currentState){
-  case IDLE:
-    fsm_idle();
-    break;
-  case FEED:
-    fsm_feed();
-    break;
-  case CONTACT:
-    fsm_contact();
-    break;
-  case CHARGE:
-    fsm_charge();
-    break;
-  case ENDCHARGE:
-    fsm_endcharge();
-    break;
-  }
 
-  // Update the clock display
-  rtc_get_datetime(&t);
-  if(tOld.min != t.min || tOld.hour != t.hour){ // avoid updating the time label too often (increases FPS)
-    draw_clock(t);
-  }
-  if(tOld.day != t.day || tOld.month != t.month || tOld.dotw != t.dotw){ // avoid updating the date label too often (increases FPS)
-    draw_date(t);
-  }
-  tOld = t;
+  scheduler_run(tasksCore0, TASK_COUNT_CORE0);
+}
 
-  
-  // Update LVGL UI
-  lv_timer_handler();
+// Core 1: charge path ----------------------------------------------------------------------------------------------------------------------
+
+void setup1() {
+  boot_phase("startup");
+  #ifdef SIMULATION
+  sim_begin(rp2040.hwrand32());
+  #endif
+  charge_begin();
+  scheduler_start(tasksCore1, TASK_COUNT_CORE1);
+}
+
+void loop1() {
+  scheduler_run(tasksCore1, TASK_COUNT_CORE1);
 }
\ No newline at end of file
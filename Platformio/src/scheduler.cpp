@@ -0,0 +1,75 @@
+// Cooperative multi-rate scheduler, see scheduler.h
+
+#include <pico/time.h>
+#include "scheduler.h"
+
+void scheduler_start(Task* tasks, int count){
+  uint32_t now = micros();
+  for(int i = 0; i < count; i++){
+    tasks[i].nextRelease = now;
+  }
+}
+
+void scheduler_run(Task* tasks, int count){
+  for(int i = 0; i < count; i++){
+    Task& task = tasks[i];
+    uint32_t start = micros();
+    if((int32_t)(start - task.nextRelease) < 0) continue;
+
+    task.startUs = start;
+    task.busy = true;
+    task.run();
+    task.busy = false;
+
+    uint32_t end = micros();
+    uint32_t latency = end - task.nextRelease;
+    task.runs++;
+    task.lastRunUs = end - start;
+    if(task.lastRunUs > task.maxRunUs) task.maxRunUs = task.lastRunUs;
+    if(task.lastRunUs > task.longestRunUs) task.longestRunUs = task.lastRunUs;
+    if(latency > task.maxLatencyUs) task.maxLatencyUs = latency;
+    if(latency > task.deadlineUs) task.overruns++;
+
+    // Keep the period fixed, but don't try to catch up on releases that were missed entirely
+    task.nextRelease += task.periodUs;
+    if((int32_t)(end - task.nextRelease) >= 0){
+      task.skipped += (end - task.nextRelease) / task.periodUs + 1;
+      task.nextRelease = end + task.periodUs;
+    }
+  }
+
+  // Sleep until the earliest release
+  uint32_t now = micros();
+  int32_t sleep = INT32_MAX;
+  for(int i = 0; i < count; i++){
+    int32_t remaining = (int32_t)(tasks[i].nextRelease - now);
+    if(remaining < sleep) sleep = remaining;
+  }
+  if(sleep > 0) sleep_us(sleep);
+}
+
+int scheduler_stuck(const Task* tasks, int count, uint32_t lateUs){
+  uint32_t now = micros();
+  int stuck = -1;
+  for(int i = 0; i < count; i++){
+    if((int32_t)(now - tasks[i].nextRelease) > (int32_t)lateUs && (stuck < 0 || tasks[i].busy)) stuck = i;
+  }
+  return stuck;
+}
+
+uint32_t scheduler_longest_pass(const Task* tasks, int count){
+  uint32_t pass = 0;
+  for(int i = 0; i < count; i++) pass += tasks[i].longestRunUs;
+  return pass;
+}
+
+void scheduler_report(Task* tasks, int count){
+  Serial.println("[sched] task          period  runs     last/max run  max latency  overruns  skipped");
+  for(int i = 0; i < count; i++){
+    Task& task = tasks[i];
+    Serial.printf("[sched] %-12s %6lu us %7lu %6lu/%6lu us %9lu us %9lu %8lu\n", task.name, task.periodUs, task.runs,
+                  task.lastRunUs, task.maxRunUs, task.maxLatencyUs, task.overruns, task.skipped);
+    task.maxRunUs = 0;
+    task.maxLatencyUs = 0;
+  }
+}
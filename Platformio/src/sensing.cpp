@@ -0,0 +1,178 @@
+// Integer sensor conversions of the charge path, see sensing.h
+
+#include "sensing.h"
+#ifdef SENSE_BENCH
+#include "stream_filter.h"
+#endif
+
+#define NTC_TABLE_STEP 32                 // ADC counts between two table entries
+#define NTC_TABLE_SIZE (4096 / NTC_TABLE_STEP + 1)
+#define NTC_TABLE_LOG2_SAMPLES 6          // interpolated on sums of 64 samples
+#define NTC_TABLE_SAMPLES (1 << NTC_TABLE_LOG2_SAMPLES)
+#define NTC_TABLE_MAX_ERROR 6             // 0.01 °C, against the Beta model between -20 and 100 °C
+
+// ln(x) for x > 0: scale into [0.75, 1.5] by powers of two, then the atanh series
+constexpr double ntc_ln(double x){
+  double result = 0;
+  while(x > 1.5){ x /= 2; result += 0.69314718055994530942; }
+  while(x < 0.75){ x *= 2; result -= 0.69314718055994530942; }
+  double y = (x - 1) / (x + 1);
+  double term = y;
+  for(int n = 1; n < 60; n += 2){
+    result += 2 * term / n;
+    term *= y * y;
+  }
+  return result;
+}
+
+// Beta model: 1/T = 1/T0 + ln(R/R0)/B, with R/R0 = Rs * counts / (R0 * (4096 - counts)); in 0.01 °C for 0 < counts < 4096
+constexpr double ntc_model(double counts){
+  double ratio = NTC_SERIES_OHM * counts / (NTC_NOMINAL_OHM * (4096 - counts));
+  return 100.0 * NTC_T0_CENTI_K * NTC_B / (NTC_B * 100.0 + NTC_T0_CENTI_K * ntc_ln(ratio)) - CENTI_K_AT_0C;
+}
+
+struct NtcTable {
+  int16_t centiC[NTC_TABLE_SIZE];   // at i * NTC_TABLE_STEP counts, the ends are a short and an open sensor
+};
+
+constexpr NtcTable ntc_table(){
+  NtcTable table{};
+  for(int i = 0; i < NTC_TABLE_SIZE; i++){
+    int counts = i * NTC_TABLE_STEP;
+    double centiC = counts == 0 ? INT16_MAX : counts == 4096 ? INT16_MIN : ntc_model(counts);
+    centiC = centiC > INT16_MAX ? INT16_MAX : centiC < INT16_MIN ? INT16_MIN : centiC;
+    table.centiC[i] = (int16_t)(centiC < 0 ? centiC - 0.5 : centiC + 0.5);
+  }
+  return table;
+}
+
+static constexpr NtcTable ntcTable = ntc_table();
+
+// Linear interpolation between the two entries around the block average
+constexpr int16_t ntc_interpolate(const NtcTable& table, uint32_t sum){
+  constexpr int32_t span = NTC_TABLE_STEP * NTC_TABLE_SAMPLES;
+  uint32_t i = sum / span;
+  if(i > NTC_TABLE_SIZE - 2) i = NTC_TABLE_SIZE - 2;
+  int32_t lower = table.centiC[i];
+  int32_t upper = table.centiC[i + 1];
+  return lower + ((upper - lower) * (int32_t)(sum - i * span) + span / 2) / span;
+}
+
+// Largest difference of the interpolation to the model, every quarter count over the range the table must be exact in
+constexpr double ntc_table_error(const NtcTable& table){
+  double maxError = 0;
+  for(uint32_t sum = NTC_TABLE_SAMPLES; sum < 4095 * NTC_TABLE_SAMPLES; sum += NTC_TABLE_SAMPLES / 4){
+    double model = ntc_model((double)sum / NTC_TABLE_SAMPLES);
+    if(model < -2000 || model > 10000) continue;
+    double error = ntc_interpolate(table, sum) - model;
+    if(error < 0) error = -error;
+    if(error > maxError) maxError = error;
+  }
+  return maxError;
+}
+
+static_assert(ntc_table_error(ntcTable) <= NTC_TABLE_MAX_ERROR, "NTC table too coarse for its error budget");
+static_assert(ntcTable.centiC[0] == INT16_MAX && ntc_interpolate(ntcTable, 4095 * NTC_TABLE_SAMPLES) < -2000,
+              "a shorted sensor must read hot and an open one cold");
+static_assert(ntc_interpolate(ntcTable, 2048 * NTC_TABLE_SAMPLES) == 2500, "half scale is the nominal 25 °C");
+
+int16_t ntc_centi_celsius(uint32_t sum, uint8_t log2Ratio){
+  if(log2Ratio > NTC_TABLE_LOG2_SAMPLES) sum >>= log2Ratio - NTC_TABLE_LOG2_SAMPLES;
+  else sum <<= NTC_TABLE_LOG2_SAMPLES - log2Ratio;
+  return ntc_interpolate(ntcTable, sum);
+}
+
+#ifdef SENSE_BENCH
+#define BENCH_FRAMES (1 << OVERSAMPLE_DEFAULT_LOG2_RATIO)
+
+// The float conversions the integer ones replaced, kept as reference
+// Source: http://www.scynd.de/tutorials/arduino-tutorials/5-sensoren/5-1-temperatur-mit-10k%CF%89-ntc.html
+static float NTCTempFromADC(float average){
+
+  const int ntcNominal = 10000;         // Wiederstand des NTC bei Nominaltemperatur
+  const int tempNominal = 25;           // Temperatur bei der der NTC den angegebenen Wiederstand hat
+  const int bCoefficient = 3380;        // Beta Coefficient(B25 aus Datenblatt des NTC)
+
+  int series_resistor = 10000;
+
+  // Convert the ADC value to a resistance
+  average = 4096 / average - 1;
+  average = series_resistor / average;
+
+  // Umrechnung aller Ergebnisse in die Temperatur mittels einer Steinhard Berechnung
+  float temp = average / ntcNominal;     // (R/Ro)
+  temp = log(temp);                     // ln(R/Ro)
+  temp /= bCoefficient;                 // 1/B * ln(R/Ro)
+  temp += 1.0 / (tempNominal + 273.15); // + (1/To)
+  temp = 1.0 / temp;                    // Invertieren
+  temp -= 273.15;                       // Umwandeln in °C
+
+  return temp;
+}
+
+static float getVBat(int32_t sum){
+  return 0.001 * 2 * 0.806 * sum / BENCH_FRAMES;
+}
+
+#define BENCH_SAMPLES 64
+
+// Cycles per update of the stream filters at the sizes the sensor task uses, after the windows have filled
+template <typename Filter>
+static uint32_t filter_cycles(Filter& filter, const int32_t* samples){
+  for(int i = 0; i < BENCH_SAMPLES; i++) filter.update(samples[i] / 64);
+  uint32_t start = rp2040.getCycleCount();
+  for(int i = 0; i < BENCH_SAMPLES; i++) filter.update(samples[BENCH_SAMPLES - 1 - i] / 64);
+  return (rp2040.getCycleCount() - start) / BENCH_SAMPLES;
+}
+
+static void filter_bench(const int32_t* samples){
+  MedianFilter<int16_t, 5> median;
+  Ema<int16_t, 6> ema;
+  SlopeFilter<int16_t, 60> slope;
+  MinMaxFilter<int16_t, 10> range;
+  uint32_t medianCycles = filter_cycles(median, samples);
+  uint32_t emaCycles = filter_cycles(ema, samples);
+  uint32_t slopeCycles = filter_cycles(slope, samples);
+  uint32_t rangeCycles = filter_cycles(range, samples);
+  Serial.printf("[sense] cycles per filter update: median of 5 %lu, EMA %lu, slope over 60 %lu, min/max over 10 %lu\n",
+                medianCycles, emaCycles, slopeCycles, rangeCycles);
+}
+
+// Cycles per conversion over a sweep of block sums from -2 V to 2 V and 0 °C to 60 °C, and the largest difference
+void sensing_bench(){
+  volatile int32_t sink = 0;
+  int32_t diffSums[BENCH_SAMPLES];
+  uint32_t ntcSums[BENCH_SAMPLES];
+  for(int i = 0; i < BENCH_SAMPLES; i++){
+    diffSums[i] = (i - BENCH_SAMPLES / 2) * 2000 * BENCH_FRAMES / (BENCH_SAMPLES / 2) * 1000 / ADC_UV_PER_LSB;
+    ntcSums[i] = (900 + i * 1800 / BENCH_SAMPLES) * BENCH_FRAMES;
+  }
+
+  uint32_t start = rp2040.getCycleCount();
+  for(int i = 0; i < BENCH_SAMPLES; i++) sink = adc_diff_mv(diffSums[i], OVERSAMPLE_DEFAULT_LOG2_RATIO);
+  uint32_t mvInt = rp2040.getCycleCount() - start;
+  start = rp2040.getCycleCount();
+  for(int i = 0; i < BENCH_SAMPLES; i++) sink = (int16_t)lroundf(getVBat(diffSums[i]) * 1000);
+  uint32_t mvFloat = rp2040.getCycleCount() - start;
+  start = rp2040.getCycleCount();
+  for(int i = 0; i < BENCH_SAMPLES; i++) sink = ntc_centi_celsius(ntcSums[i], OVERSAMPLE_DEFAULT_LOG2_RATIO);
+  uint32_t ntcInt = rp2040.getCycleCount() - start;
+  start = rp2040.getCycleCount();
+  for(int i = 0; i < BENCH_SAMPLES; i++) sink = lroundf(NTCTempFromADC((float)ntcSums[i] / BENCH_FRAMES) * 100);
+  uint32_t ntcFloat = rp2040.getCycleCount() - start;
+  (void)sink;
+
+  int mvError = 0;
+  int ntcError = 0;
+  for(int i = 0; i < BENCH_SAMPLES; i++){
+    mvError = max(mvError, abs(adc_diff_mv(diffSums[i], OVERSAMPLE_DEFAULT_LOG2_RATIO) - (int)lroundf(getVBat(diffSums[i]) * 1000)));
+    int centiC = ntc_centi_celsius(ntcSums[i], OVERSAMPLE_DEFAULT_LOG2_RATIO);
+    ntcError = max(ntcError, abs(centiC - (int)lroundf(NTCTempFromADC((float)ntcSums[i] / BENCH_FRAMES) * 100)));
+  }
+  Serial.printf("[sense] cycles per conversion, integer/float: voltage %lu/%lu, temperature %lu/%lu; "
+                "max difference %d mV, %d.%02d °C\n", mvInt / BENCH_SAMPLES, mvFloat / BENCH_SAMPLES,
+                ntcInt / BENCH_SAMPLES, ntcFloat / BENCH_SAMPLES, mvError, ntcError / 100, ntcError % 100);
+
+  filter_bench(diffSums);
+}
+#endif
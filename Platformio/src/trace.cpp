@@ -0,0 +1,270 @@
+// Record and replay of the charge path at the hardware access layer, see trace.h
+
+#include <atomic>
+#include "spsc_queue.h"
+#include "trace.h"
+
+#if defined(TRACE_RECORD) || defined(TRACE_REPLAY)
+
+#define TRACE_TOKEN_SIZE 20
+#define TRACE_LINE_SIZE (8 + TRACE_LINE_RECORDS * TRACE_TOKEN_SIZE)
+#define TRACE_WINDOW_FIELDS 6     // records per AdcWindow
+
+// Recording: core 1 -> core 0, replaying: core 0 -> core 1
+static SpscQueue<TraceRecord, TRACE_QUEUE_SIZE> traceQueue;
+static volatile bool traceActive = false;
+
+// Only the charge path on core 1 is traced, core 0 calls the HAL when the watchdog trips
+static bool trace_core(){
+  return traceActive && rp2040.cpuid() == 1;
+}
+
+static bool has_source(char channel){
+  return channel == TRACE_ANALOG || channel == TRACE_DIGITAL || channel == TRACE_RESUME || channel == TRACE_CLOCK ||
+         channel == TRACE_WRITE || channel == TRACE_RATIO;
+}
+
+static void format_token(char* token, const TraceRecord& record, bool withValue){
+  int n = snprintf(token, TRACE_TOKEN_SIZE, "%c", record.channel);
+  if(has_source(record.channel)) n += snprintf(token + n, TRACE_TOKEN_SIZE - n, withValue ? "%u:" : "%u", record.source);
+  if(withValue) snprintf(token + n, TRACE_TOKEN_SIZE - n, "%ld", (long)record.value);
+}
+
+#endif
+
+// Recording ------------------------------------------------------------------------------------------------------------------------------
+
+#if defined(TRACE_RECORD)
+
+static uint32_t recordTime = 0; // hal_millis() of the last time record
+static uint32_t recordLost = 0; // drops already reported
+
+void trace_begin(){
+  while(!Serial) delay(10);
+  traceActive = true;
+}
+
+int32_t trace_record(char channel, uint8_t source, int32_t value){
+  if(trace_core()) traceQueue.push({channel, source, value});
+  return value;
+}
+
+uint32_t trace_record_time(uint32_t now){
+  if(trace_core() && now != recordTime){
+    traceQueue.push({TRACE_TIME, 0, (int32_t)(now - recordTime)});
+    recordTime = now;
+  }
+  return now;
+}
+
+void trace_adc_block(AdcBlock& block){
+  trace_record(TRACE_ANALOG, 0, block.sequence);
+  for(int i = 0; i < ADC_CHANNELS; i++){
+    AdcWindow& window = block.window[i];
+    uint8_t source = 1 + i * TRACE_WINDOW_FIELDS;
+    trace_record(TRACE_ANALOG, source, window.sequence);
+    trace_record(TRACE_ANALOG, source + 1, window.sum);
+    trace_record(TRACE_ANALOG, source + 2, window.varianceQ8);
+    trace_record(TRACE_ANALOG, source + 3, window.min);
+    trace_record(TRACE_ANALOG, source + 4, window.max);
+    trace_record(TRACE_ANALOG, source + 5, window.log2Ratio);
+  }
+}
+
+void trace_poll(){
+  uint32_t lost = traceQueue.drops(); // counted on core 1, a stale value is only reported late
+  if(lost != recordLost){
+    Serial.printf("[trace] lost %lu records, the trace cannot be replayed\n", lost - recordLost);
+    recordLost = lost;
+  }
+
+  // whole lines only, the charge path produces records continuously
+  while(traceQueue.size() >= TRACE_LINE_RECORDS){
+    char line[TRACE_LINE_SIZE] = "[trace]";
+    int length = strlen(line);
+    for(int i = 0; i < TRACE_LINE_RECORDS; i++){
+      TraceRecord record;
+      traceQueue.pop(record);
+      line[length++] = ' ';
+      format_token(line + length, record, true);
+      length += strlen(line + length);
+    }
+    Serial.println(line);
+  }
+}
+
+#endif
+
+// Replaying ------------------------------------------------------------------------------------------------------------------------------
+
+#if defined(TRACE_REPLAY)
+
+// Written by core 0
+static std::atomic<uint32_t> replayPassesQueued{0};
+static std::atomic<bool> replayEnded{false};
+static bool replayReported = false;
+static char replayLine[TRACE_LINE_SIZE];
+static int replayLineLength = 0;
+
+// Written by core 1
+static uint32_t replayPassesRun = 0;
+static uint32_t replayRecords = 0;
+static uint32_t replayTime = 0;
+static std::atomic<bool> replayFinished{false};
+static std::atomic<bool> replayDiverged{false};
+
+// The first difference, written once by core 1 before replayDiverged is set
+struct Divergence {
+  uint32_t record;
+  bool traceHasRecord;    // false: the trace ended
+  TraceRecord trace;
+  TraceRecord firmware;   // channel 0: the firmware finished the pass
+  bool firmwareRead;      // an input, its value comes from the trace
+};
+static Divergence divergence;
+
+static void replay_diverge(bool traceHasRecord, const TraceRecord& trace, const TraceRecord& firmware, bool firmwareRead){
+  divergence = {replayRecords, traceHasRecord, trace, firmware, firmwareRead};
+  replayDiverged.store(true, std::memory_order_release);
+}
+
+static bool replay_running(){
+  return trace_core() && !replayDiverged.load(std::memory_order_relaxed);
+}
+
+static void replay_consume(const TraceRecord& record){
+  replayRecords++;
+  if(record.channel == TRACE_TASK) replayPassesRun++;
+}
+
+// The next record must be the firmware's access, outputs must also match in value
+static bool replay_match(const TraceRecord& firmware, bool output, TraceRecord& record){
+  if(!replay_running()) return false;
+  bool available = traceQueue.pop(record);
+  if(available && record.channel == firmware.channel && record.source == firmware.source &&
+     (!output || record.value == firmware.value)){
+    replay_consume(record);
+    return true;
+  }
+  replay_diverge(available, record, firmware, !output);
+  return false;
+}
+
+void trace_begin(){
+  traceActive = true;
+  while(replayPassesQueued.load(std::memory_order_acquire) == 0 && !replayEnded.load(std::memory_order_acquire)) delay(1);
+}
+
+int32_t trace_replay_input(char channel, uint8_t source){
+  TraceRecord record;
+  return replay_match({channel, source, 0}, false, record) ? record.value : 0;
+}
+
+void trace_replay_output(char channel, uint8_t source, int32_t value){
+  TraceRecord record;
+  replay_match({channel, source, value}, true, record);
+}
+
+void trace_adc_block(AdcBlock& block){
+  block.sequence = trace_replay_input(TRACE_ANALOG, 0);
+  for(int i = 0; i < ADC_CHANNELS; i++){
+    AdcWindow& window = block.window[i];
+    uint8_t source = 1 + i * TRACE_WINDOW_FIELDS;
+    window.sequence = trace_replay_input(TRACE_ANALOG, source);
+    window.sum = trace_replay_input(TRACE_ANALOG, source + 1);
+    window.varianceQ8 = trace_replay_input(TRACE_ANALOG, source + 2);
+    window.min = trace_replay_input(TRACE_ANALOG, source + 3);
+    window.max = trace_replay_input(TRACE_ANALOG, source + 4);
+    window.log2Ratio = trace_replay_input(TRACE_ANALOG, source + 5);
+  }
+}
+
+uint32_t trace_replay_time(){
+  int32_t delta;
+  if(trace_replay_optional(TRACE_TIME, delta)) replayTime += delta;
+  return replayTime;
+}
+
+bool trace_replay_optional(char channel, int32_t& value){
+  TraceRecord record;
+  if(!replay_running() || !traceQueue.peek(record) || record.channel != channel) return false;
+  traceQueue.pop(record);
+  replay_consume(record);
+  value = record.value;
+  return true;
+}
+
+int trace_replay_next_task(){
+  if(!replay_running()) return -1;
+  // a pass is complete once the next one has started, the recording stopped somewhere in the last one
+  bool ended = replayEnded.load(std::memory_order_acquire);
+  TraceRecord record;
+  if(replayPassesQueued.load(std::memory_order_acquire) < replayPassesRun + 2 || !traceQueue.peek(record)){
+    if(ended) replayFinished.store(true, std::memory_order_release);
+    return -1;
+  }
+  if(record.channel != TRACE_TASK){
+    replay_diverge(true, record, {0, 0, 0}, false);
+    return -1;
+  }
+  return record.value;
+}
+
+static void replay_parse(char* line){
+  if(strncmp(line, "[trace] ", 8) != 0) return;
+  for(char* token = strtok(line + 8, " "); token; token = strtok(NULL, " ")){
+    if(strcmp(token, "end") == 0){
+      replayEnded.store(true, std::memory_order_release);
+      return;
+    }
+    TraceRecord record = {token[0], 0, 0};
+    char* end;
+    long number = strtol(token + 1, &end, 10);
+    if(*end == ':'){
+      record.source = number;
+      number = strtol(end + 1, &end, 10);
+    }
+    record.value = number;
+    if(*end || !traceQueue.push(record)){
+      Serial.printf("[trace] cannot replay token %s\n", token);
+      continue;
+    }
+    if(record.channel == TRACE_TASK) replayPassesQueued.fetch_add(1, std::memory_order_release);
+  }
+}
+
+static void replay_report(){
+  if(replayDiverged.load(std::memory_order_acquire)){
+    char trace[TRACE_TOKEN_SIZE] = "nothing";
+    char firmware[TRACE_TOKEN_SIZE];
+    if(divergence.traceHasRecord) format_token(trace, divergence.trace, true);
+    if(divergence.firmware.channel) format_token(firmware, divergence.firmware, !divergence.firmwareRead);
+    Serial.printf("[trace] replay diverged at record %lu: trace has %s, firmware %s%s\n", divergence.record, trace,
+                  divergence.firmware.channel ? (divergence.firmwareRead ? "read " : "wrote ") : "finished the pass",
+                  divergence.firmware.channel ? firmware : "");
+  }
+  else{
+    Serial.printf("[trace] replay matched %lu records in %lu passes, %lu ms\n", replayRecords, replayPassesRun,
+                  replayTime);
+  }
+  replayReported = true;
+}
+
+void trace_poll(){
+  if(!replayReported && (replayDiverged.load(std::memory_order_acquire) || replayFinished.load(std::memory_order_acquire))){
+    replay_report();
+  }
+
+  // a line at a time while the queue has room for a whole line
+  while(Serial.available() && TRACE_QUEUE_SIZE - traceQueue.size() >= TRACE_LINE_RECORDS){
+    char c = Serial.read();
+    if(c == '\n' || c == '\r'){
+      replayLine[replayLineLength] = 0;
+      if(replayLineLength) replay_parse(replayLine);
+      replayLineLength = 0;
+    }
+    else if(replayLineLength < TRACE_LINE_SIZE - 1) replayLine[replayLineLength++] = c;
+  }
+}
+
+#endif
@@ -0,0 +1,51 @@
+// The fault scenarios of charge.cpp against the simulated charger, one after another as a bench session would run them
+
+#define SIMULATION
+#define FAULT_INJECTION
+#include <unity.h>
+#include "charge_path.h"
+
+#define SIM_SEED 1
+#define FAULT_POLL_MS 10          // period of the fault task on the UI core
+#define SCENARIO_MAX_MS (12 * 3600000UL) // until the state comes up and the reaction is timed
+
+void setUp(){}
+
+void tearDown(){}
+
+// Queue the command and step the charge path until the verdict is printed, NULL if it never is
+static const char* run_scenario(const char* name){
+  Serial.output.clear();
+  Serial.input += std::string("fault ") + name + "\n";
+  uint32_t end = sim_millis() + SCENARIO_MAX_MS;
+  while(sim_millis() < end){
+    charge_sim_step();
+    if(sim_millis() % FAULT_POLL_MS) continue;
+    ChargeEvent event;
+    while(eventBus.pop(event)){}
+    fault_poll(faultScenarios, FAULT_SCENARIO_COUNT);
+    const char* verdict = strstr(Serial.output.c_str(), " - ");
+    if(verdict) return verdict;
+  }
+  return NULL;
+}
+
+void test_scenarios(){
+  boot_phase("startup");
+  sim_begin(SIM_SEED);
+  charge_begin();
+  for(int i = 0; i < FAULT_SCENARIO_COUNT; i++){
+    const char* verdict = run_scenario(faultScenarios[i].name);
+    TEST_ASSERT_NOT_NULL_MESSAGE(verdict, faultScenarios[i].name);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(" - ok\n", verdict, faultScenarios[i].name);
+  }
+  SimStats stats;
+  sim_stats(stats);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.shootThroughMs);
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_scenarios);
+  return UNITY_END();
+}
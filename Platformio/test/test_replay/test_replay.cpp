@@ -0,0 +1,101 @@
+// Every trace in traces/ replayed against the charge path, see trace.h. A trace is the [trace] lines of a recording, from
+// the unit or from native/record_trace.cpp; it stops matching as soon as the charge path changes what it does.
+
+#define TRACE_REPLAY
+#include <unity.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include "charge_path.h"
+
+static std::string traceDir(){
+  std::string file = __FILE__;
+  return file.substr(0, file.find_last_of('/') + 1) + "traces/";
+}
+
+static std::string read_file(const std::string& path){
+  std::ifstream in(path);
+  std::stringstream text;
+  text << in.rdbuf();
+  return text.str();
+}
+
+// Replay from boot and return the result line. The charge path cannot be reset, so every replay runs in a child process.
+static std::string replay(const std::string& trace){
+  int pipes[2];
+  TEST_ASSERT_EQUAL_INT(0, pipe(pipes));
+  fflush(stdout);
+  pid_t pid = fork();
+  if(pid == 0){
+    close(pipes[0]);
+    Serial.echo = false;
+    Serial.input = trace + "\n[trace] end\n";
+    trace_poll(); // the first passes must be queued before core 1 starts
+    boot_phase("startup");
+    charge_begin();
+    size_t result;
+    while((result = Serial.output.find("[trace] replay")) == std::string::npos){
+      task_replay();
+      trace_poll();
+    }
+    std::string line = Serial.output.substr(result, Serial.output.find('\n', result) - result);
+    ssize_t written = write(pipes[1], line.c_str(), line.size());
+    _exit(written == (ssize_t)line.size() ? 0 : 1);
+  }
+  close(pipes[1]);
+  std::string line;
+  char buffer[256];
+  ssize_t n;
+  while((n = read(pipes[0], buffer, sizeof(buffer))) > 0) line.append(buffer, n);
+  close(pipes[0]);
+  int status;
+  waitpid(pid, &status, 0);
+  TEST_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  return line;
+}
+
+static std::vector<std::string> traces(){
+  std::vector<std::string> names;
+  DIR* dir = opendir(traceDir().c_str());
+  if(!dir) return names;
+  while(dirent* entry = readdir(dir)){
+    std::string name = entry->d_name;
+    if(name.size() > 6 && name.compare(name.size() - 6, 6, ".trace") == 0) names.push_back(name);
+  }
+  closedir(dir);
+  return names;
+}
+
+void setUp(){}
+
+void tearDown(){}
+
+void test_traces_match(){
+  std::vector<std::string> names = traces();
+  TEST_ASSERT_TRUE(names.size() > 0);
+  for(const std::string& name : names){
+    std::string result = replay(read_file(traceDir() + name));
+    TEST_MESSAGE((name + ": " + result).c_str());
+    TEST_ASSERT_EQUAL_STRING_MESSAGE("[trace] replay matched", result.substr(0, 22).c_str(), name.c_str());
+  }
+}
+
+// a servo write the firmware does not make must be reported, or a matching replay would mean nothing
+void test_changed_output_diverges(){
+  std::string trace = read_file(traceDir() + traces().front());
+  size_t servo = trace.find(" s1176 ");
+  TEST_ASSERT_TRUE(servo != std::string::npos);
+  trace.replace(servo, 7, " s1177 ");
+  std::string result = replay(trace);
+  TEST_ASSERT_EQUAL_STRING("[trace] replay diverged", result.substr(0, 23).c_str());
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_traces_match);
+  RUN_TEST(test_changed_output_diverges);
+  return UNITY_END();
+}
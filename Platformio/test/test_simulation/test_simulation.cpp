@@ -0,0 +1,148 @@
+// The unmodified charge path against the models of charger_sim.h, several simulated hours without a time budget
+
+#define SIMULATION
+#include <unity.h>
+#include "charge_path.h"
+
+#define SIM_SEED 1
+#define SIM_HOURS 12
+#define UI_PERIOD_MS 10           // the UI core drains the event bus once per frame
+#define CELL_MAX_MS (2 * CHARGE_MAX_DWELL_MS) // until a cell of the type has left, the cells on the arm and in the chute go first
+
+static SimStats stats;
+static uint32_t faults[FAULT_REASON_COUNT];
+static uint32_t realMs;
+
+// Boot core 1 from reset and run it for SIM_HOURS, the test stands in for the UI core
+static void simulate(){
+  boot_phase("startup");
+  sim_begin(SIM_SEED);
+  charge_begin();
+  uint32_t realStart = millis();
+  while(sim_millis() < SIM_HOURS * 3600000UL){
+    charge_sim_step();
+    if(sim_millis() % UI_PERIOD_MS) continue;
+    ChargeEvent event;
+    while(eventBus.pop(event)) if(event.type == EVT_FAULT && event.fault < FAULT_REASON_COUNT) faults[event.fault]++;
+  }
+  realMs = millis() - realStart;
+  sim_stats(stats);
+  sim_report();
+  charge_stats_report();
+}
+
+// What happened to one cell of a type, fed after the SIM_HOURS run
+struct CellRun {
+  uint32_t faults[FAULT_REASON_COUNT];
+  bool charged;
+  bool ejected;
+};
+
+static CellRun feed_one(SIM_CELL_TYPE type){
+  CellRun run = {};
+  SimStats before, now;
+  sim_stats(before);
+  sim_cell_type(type);
+  uint32_t end = sim_millis() + CELL_MAX_MS;
+  while(sim_millis() < end){
+    charge_sim_step();
+    sim_stats(now);
+    if(sim_millis() % UI_PERIOD_MS == 0){
+      ChargeEvent event;
+      while(eventBus.pop(event)){
+        if(event.type == EVT_FAULT && event.fault < FAULT_REASON_COUNT && now.fed[type] > before.fed[type]) run.faults[event.fault]++;
+      }
+    }
+    if(now.ejected[type] > before.ejected[type]) break;
+  }
+  sim_cell_type(CELL_TYPE_COUNT);
+  run.charged = now.charged[type] > before.charged[type];
+  run.ejected = now.ejected[type] > before.ejected[type];
+  return run;
+}
+
+// The cell is rejected with exactly this fault and ejected without a charge
+static void assert_rejected(SIM_CELL_TYPE type, int fault){
+  CellRun run = feed_one(type);
+  TEST_ASSERT_TRUE(run.ejected);
+  TEST_ASSERT_FALSE(run.charged);
+  for(int i = 0; i < FAULT_REASON_COUNT; i++){
+    char reason[24];
+    snprintf(reason, sizeof(reason), "FAULT_REASON %d", i);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(i == fault ? 1 : 0, run.faults[i], reason);
+  }
+}
+
+void setUp(){}
+
+void tearDown(){}
+
+void test_no_shoot_through(){
+  TEST_ASSERT_EQUAL_UINT32(0, stats.shootThroughMs);
+}
+
+void test_nimh_cells_charged(){
+  TEST_ASSERT_GREATER_THAN_UINT32(0, stats.charged[CELL_NIMH]);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, stats.charged[CELL_NIMH_MARGINAL]); // after a re-seat
+}
+
+void test_bad_cells_never_charged(){
+  TEST_ASSERT_GREATER_THAN_UINT32(0, stats.fed[CELL_ALKALINE] + stats.fed[CELL_DEAD] + stats.fed[CELL_SHORTED]);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.charged[CELL_ALKALINE]);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.charged[CELL_DEAD]);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.charged[CELL_SHORTED]);
+}
+
+// every cell that was taken from the chute left through the output chute, except the one on the arm at the end
+void test_cells_ejected(){
+  uint32_t fed = 0, ejected = 0;
+  for(int i = 0; i < CELL_TYPE_COUNT; i++){
+    fed += stats.fed[i];
+    ejected += stats.ejected[i];
+  }
+  TEST_ASSERT_UINT32_WITHIN(1, fed, ejected);
+  TEST_ASSERT_EQUAL_UINT32(ejected, chargeStats.cells);
+}
+
+// no state overstays its dwell time and the charger reset is always detected, the timeout is only the fallback
+void test_no_timeouts(){
+  TEST_ASSERT_EQUAL_UINT32(0, faults[FAULT_TIMEOUT]);
+  TEST_ASSERT_EQUAL_UINT32(0, chargeStats.resetTimeouts);
+}
+
+void test_alkaline_screened(){
+  assert_rejected(CELL_ALKALINE, FAULT_HIGH_RESISTANCE);
+}
+
+void test_dead_screened(){
+  assert_rejected(CELL_DEAD, FAULT_DEAD);
+}
+
+void test_shorted_screened(){
+  assert_rejected(CELL_SHORTED, FAULT_SHORTED);
+}
+
+// the temperature rise ends the charge long before the cell leaves the temperature window
+void test_heating_cell_stopped(){
+  assert_rejected(CELL_NIMH_HOT, FAULT_TEMPERATURE_RISE);
+}
+
+int main(){
+  simulate();
+  char speed[80];
+  snprintf(speed, sizeof(speed), "%d h simulated in %lu ms, %lux", SIM_HOURS, (unsigned long)realMs,
+           (unsigned long)(SIM_HOURS * 3600000UL / (realMs ? realMs : 1)));
+  UNITY_BEGIN();
+  TEST_MESSAGE(speed);
+  RUN_TEST(test_no_shoot_through);
+  RUN_TEST(test_nimh_cells_charged);
+  RUN_TEST(test_bad_cells_never_charged);
+  RUN_TEST(test_cells_ejected);
+  RUN_TEST(test_no_timeouts);
+  // after the statistics above, these feed more cells
+  RUN_TEST(test_alkaline_screened);
+  RUN_TEST(test_dead_screened);
+  RUN_TEST(test_shorted_screened);
+  RUN_TEST(test_heating_cell_stopped);
+  return UNITY_END();
+}
@@ -0,0 +1,172 @@
+// Stream filters against brute-force references over the same window, see stream_filter.h
+
+#include <unity.h>
+#include <algorithm>
+#include "stream_filter.h"
+
+#define SAMPLES 100000
+
+// Noise around a level that steps now and then, with single spikes
+static uint32_t seed;
+
+static int16_t next_sample(){
+  static int16_t level = 0;
+  seed = seed * 1664525 + 1013904223;
+  uint32_t r = seed >> 8;
+  if(r % 1000 == 0) level = (int16_t)(r % 4001) - 2000;
+  if(r % 97 == 0) return (r & 1) ? 30000 : -30000;
+  return level + (int16_t)(r % 41) - 20;
+}
+
+// The last n samples, oldest first
+template <typename T, int N>
+struct Window {
+  T samples[N];
+  int count = 0;
+
+  void add(T sample){
+    if(count == N) std::copy(samples + 1, samples + N, samples);
+    else count++;
+    samples[count - 1] = sample;
+  }
+};
+
+void setUp(){
+  seed = 1;
+}
+
+void tearDown(){}
+
+template <typename T, int N>
+static void check_median(){
+  MedianFilter<T, N> filter;
+  Window<T, N> window;
+  for(int i = 0; i < SAMPLES; i++){
+    T sample = next_sample();
+    window.add(sample);
+    // the median is the sample with (count - 1) / 2 samples below it, ties counted in window order
+    int rank = (window.count - 1) / 2;
+    T median = 0;
+    for(int j = 0; j < window.count; j++){
+      int below = 0;
+      for(int k = 0; k < window.count; k++){
+        T other = window.samples[k];
+        if(other < window.samples[j] || (other == window.samples[j] && k < j)) below++;
+      }
+      if(below == rank) median = window.samples[j];
+    }
+    TEST_ASSERT_EQUAL_INT(median, filter.update(sample));
+  }
+}
+
+void test_median(){
+  check_median<int16_t, 5>();
+  check_median<int, 3>();
+  check_median<int32_t, 7>();
+}
+
+void test_median_rejects_single_spike(){
+  MedianFilter<int16_t, 5> filter;
+  for(int i = 0; i < 10; i++) filter.update(1200);
+  TEST_ASSERT_EQUAL_INT(1200, filter.update(-30000));
+  TEST_ASSERT_EQUAL_INT(1200, filter.update(1200));
+  TEST_ASSERT_EQUAL_INT(1200, filter.update(30000));
+}
+
+// The exact average in floating point, the filter keeps LOG2_N fraction bits and may differ by one count
+template <int LOG2_N>
+static void check_ema(){
+  Ema<int16_t, LOG2_N> filter;
+  double average = 0;
+  for(int i = 0; i < SAMPLES; i++){
+    int16_t sample = next_sample();
+    average = i == 0 ? sample : average + (sample - average) / (1 << LOG2_N);
+    TEST_ASSERT_INT_WITHIN(1, (long)(average < 0 ? average - 0.5 : average + 0.5), filter.update(sample));
+  }
+}
+
+void test_ema(){
+  check_ema<1>();
+  check_ema<6>();
+  check_ema<10>();
+}
+
+void test_ema_settles_on_step(){
+  Ema<int16_t, 6> filter;
+  filter.update(0);
+  for(int i = 0; i < 1000; i++) filter.update(2500);
+  TEST_ASSERT_EQUAL_INT(2500, filter.value());
+}
+
+// Least squares over the window with x = 0 for the oldest sample, in exact integers
+template <typename T, int N>
+static int32_t reference_slope(const Window<T, N>& window, int32_t per){
+  int64_t n = window.count;
+  if(n < 2) return 0;
+  int64_t sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+  for(int x = 0; x < n; x++){
+    sumX += x;
+    sumY += window.samples[x];
+    sumXX += (int64_t)x * x;
+    sumXY += (int64_t)x * window.samples[x];
+  }
+  return (n * sumXY - sumX * sumY) * per / (n * sumXX - sumX * sumX);
+}
+
+template <typename T, int N>
+static void check_slope(int32_t per){
+  SlopeFilter<T, N> filter;
+  Window<T, N> window;
+  for(int i = 0; i < SAMPLES; i++){
+    T sample = next_sample();
+    filter.update(sample);
+    window.add(sample);
+    TEST_ASSERT_EQUAL_INT(reference_slope(window, per), filter.slope(per));
+  }
+}
+
+void test_slope(){
+  check_slope<int16_t, 60>(60);
+  check_slope<int16_t, 2>(1);
+  check_slope<int32_t, 17>(1000);
+}
+
+void test_slope_of_ramp(){
+  SlopeFilter<int16_t, 60> filter;
+  TEST_ASSERT_EQUAL_INT(0, filter.slope(60));
+  for(int i = 0; i < 200; i++){
+    filter.update(2500 + 3 * i);
+    if(i > 0) TEST_ASSERT_EQUAL_INT(180, filter.slope(60));
+  }
+}
+
+template <typename T, int N>
+static void check_min_max(){
+  MinMaxFilter<T, N> filter;
+  Window<T, N> window;
+  for(int i = 0; i < SAMPLES; i++){
+    T sample = next_sample();
+    filter.update(sample);
+    window.add(sample);
+    TEST_ASSERT_EQUAL_INT(*std::min_element(window.samples, window.samples + window.count), filter.lowest());
+    TEST_ASSERT_EQUAL_INT(*std::max_element(window.samples, window.samples + window.count), filter.highest());
+  }
+}
+
+void test_min_max(){
+  check_min_max<int16_t, 10>();
+  check_min_max<int32_t, 1>();
+  check_min_max<int16_t, 64>();
+}
+
+int main(){
+  UNITY_BEGIN();
+  RUN_TEST(test_median);
+  RUN_TEST(test_median_rejects_single_spike);
+  RUN_TEST(test_ema);
+  RUN_TEST(test_ema_settles_on_step);
+  RUN_TEST(test_slope);
+  RUN_TEST(test_slope_of_ramp);
+  RUN_TEST(test_min_max);
+  return UNITY_END();
+}